@@ -0,0 +1,144 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2021 jkadbear.
+#
+# This is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3, or (at your option)
+# any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software; see the file COPYING.  If not, write to
+# the Free Software Foundation, Inc., 51 Franklin Street,
+# Boston, MA 02110-1301, USA.
+#
+
+"""
+Throughput of lora.channelizer against one filter per channel.
+
+The reference front-end is what examples/rx_usrp.grc does for a single
+channel (shift to baseband, low-pass, decimate), repeated for every
+channel. Both variants use the same prototype filter.
+
+The demodulators need an integer sample rate to bandwidth ratio. When the
+channel rate (samp_rate/channels) is not a multiple of the LoRa bandwidth,
+both chains end in the rational resampler that brings each channel to
+fs_bw_ratio*bw, e.g. 200 kHz -> 250 kHz (5/4) for 1.6 MHz, 8 channels,
+125 kHz and fs_bw_ratio 2.
+"""
+
+from __future__ import print_function
+
+import argparse
+import math
+import time
+from fractions import Fraction
+
+from gnuradio import gr, blocks, analog, filter
+import lora
+
+
+def prototype_taps(num_channels, taps_per_channel, beta):
+    # same Kaiser windowed-sinc as channelizer_impl::build_taps
+    L = num_channels * taps_per_channel
+    fc = 0.5 / num_channels
+    i0 = lambda x: sum((x / 2.0) ** (2 * k) / math.factorial(k) ** 2 for k in range(30))
+    taps = []
+    for n in range(L):
+        x = n - (L - 1) / 2.0
+        h = 2 * fc if x == 0 else math.sin(2 * math.pi * fc * x) / (math.pi * x)
+        r = 2.0 * n / (L - 1) - 1.0
+        taps.append(h * i0(beta * math.sqrt(1 - r * r)) / i0(beta))
+    gain = sum(taps)
+    return [t / gain for t in taps]
+
+
+def resampling(args):
+    # (interpolation, decimation) from the channel rate to fs_bw_ratio*bw, None if it is a multiple already
+    chan_rate = Fraction(int(args.samp_rate), args.channels)
+    if (chan_rate / int(args.bw)).denominator == 1:
+        return None
+    ratio = Fraction(int(args.fs_bw_ratio * args.bw)) / chan_rate
+    return ratio.numerator, ratio.denominator
+
+
+def channel_sink(tb, args, src):
+    # what a demodulator would be connected to
+    resamp = resampling(args)
+    sink = blocks.null_sink(gr.sizeof_gr_complex)
+    if resamp is None:
+        tb.connect(src, sink)
+    else:
+        tb.connect(src, filter.rational_resampler_ccc(resamp[0], resamp[1]), sink)
+
+
+def source(tb, nsamples):
+    src = analog.fastnoise_source_c(analog.GR_GAUSSIAN, 1.0, 0, 8192)
+    head = blocks.head(gr.sizeof_gr_complex, nsamples)
+    tb.connect(src, head)
+    return head
+
+
+def channelizer_fg(args):
+    tb = gr.top_block()
+    head = source(tb, args.nsamples)
+    chan = lora.channelizer(args.channels, args.taps_per_channel, args.beta)
+    tb.connect(head, chan)
+    for c in range(args.channels):
+        channel_sink(tb, args, (chan, c))
+    return tb
+
+
+def filter_per_channel_fg(args):
+    tb = gr.top_block()
+    head = source(tb, args.nsamples)
+    taps = prototype_taps(args.channels, args.taps_per_channel, args.beta)
+    for c in range(args.channels):
+        center = c if c <= args.channels // 2 else c - args.channels
+        xlate = filter.freq_xlating_fir_filter_ccf(args.channels, taps, float(center) / args.channels, 1.0)
+        tb.connect(head, xlate)
+        channel_sink(tb, args, xlate)
+    return tb
+
+
+def measure(name, make_fg, args):
+    best = float('inf')
+    for _ in range(args.runs):
+        tb = make_fg(args)
+        start = time.time()
+        tb.run()
+        best = min(best, time.time() - start)
+    print('{:<24s} {:8.3f} s  {:8.2f} Msps'.format(name, best, args.nsamples / best / 1e6))
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--channels', type=int, default=8)
+    parser.add_argument('--taps-per-channel', type=int, default=16)
+    parser.add_argument('--beta', type=float, default=6.76)
+    parser.add_argument('--samp-rate', type=float, default=1.6e6)
+    parser.add_argument('--bw', type=float, default=125e3)
+    parser.add_argument('--fs-bw-ratio', type=int, default=2)
+    parser.add_argument('--nsamples', type=int, default=int(100e6))
+    parser.add_argument('--runs', type=int, default=3)
+    args = parser.parse_args()
+
+    resamp = resampling(args)
+    if resamp is not None:
+        print('channel rate {:g} Hz, resampling {}/{} to {:g} Hz'.format(
+            args.samp_rate / args.channels, resamp[0], resamp[1], args.fs_bw_ratio * args.bw))
+
+    t_filt = measure('filter per channel', filter_per_channel_fg, args)
+    t_chan = measure('lora.channelizer', channelizer_fg, args)
+    print('speedup: {:.2f}x'.format(t_filt / t_chan))
+
+
+if __name__ == '__main__':
+    main()
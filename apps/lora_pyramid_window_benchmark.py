@@ -0,0 +1,99 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2021 jkadbear.
+#
+# This is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3, or (at your option)
+# any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software; see the file COPYING.  If not, write to
+# the Free Software Foundation, Inc., 51 Franklin Street,
+# Boston, MA 02110-1301, USA.
+#
+
+"""
+Decode rate and run time of lora.pyramid_demod with the Kaiser window
+(two FFTs per hop) against the Blackman-Harris window derived from the
+plain spectrum (one FFT per hop).
+
+The receive chain and its defaults follow examples/rx_file_collision.grc,
+without the throttle.
+"""
+
+from __future__ import print_function
+
+import argparse
+import time
+
+import pmt
+from gnuradio import gr, blocks, filter
+from gnuradio.filter import firdes
+import lora
+
+
+WINDOWS = [('Kaiser', 0), ('Blackman-Harris', 1)]
+
+
+def run(args, window):
+    ldr = 2 ** args.sf / args.bw > 16e-3
+
+    tb = gr.top_block()
+    src = blocks.file_source(gr.sizeof_gr_complex, args.file, False)
+    lpf = filter.fir_filter_ccf(1, firdes.low_pass(1, args.samp_rate, args.bw / 2 + 10e3, 1e3,
+                                                   firdes.WIN_RECTANGULAR, 6.76))
+    resampler = filter.pfb.arb_resampler_ccf(2 * args.bw / args.samp_rate, taps=None, flt_size=32)
+    resampler.declare_sample_delay(0)
+    demod = lora.pyramid_demod(args.sf, ldr, args.beta, args.fft_factor, args.threshold, 2,
+                               1000, 40, window)
+    decode = lora.decode(args.sf, args.header, args.payload_len, args.cr, args.crc, ldr)
+    store = blocks.message_debug()
+
+    tb.connect(src, lpf, resampler, demod)
+    tb.msg_connect(demod, 'out', decode, 'in')
+    tb.msg_connect(decode, 'header', demod, 'header')
+    tb.msg_connect(decode, 'out', store, 'store')
+
+    start = time.time()
+    tb.run()
+    elapsed = time.time() - start
+
+    packets = store.num_messages()
+    valid = 0
+    for i in range(packets):
+        payload = pmt.u8vector_elements(pmt.cdr(store.get_message(i)))
+        # with CRC on, lora.decode appends the check result as the last byte
+        if args.crc and payload and payload[-1] == 1:
+            valid += 1
+    return elapsed, packets, valid
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('file', help='complex float recording, e.g. sf8_bw125_cr45_collision')
+    parser.add_argument('--samp-rate', type=float, default=1e6)
+    parser.add_argument('--bw', type=float, default=125e3)
+    parser.add_argument('--sf', type=int, default=8)
+    parser.add_argument('--cr', type=int, default=4)
+    parser.add_argument('--payload-len', type=int, default=8)
+    parser.add_argument('--no-header', dest='header', action='store_false')
+    parser.add_argument('--no-crc', dest='crc', action='store_false')
+    parser.add_argument('--beta', type=float, default=25.0)
+    parser.add_argument('--fft-factor', type=int, default=8)
+    parser.add_argument('--threshold', type=float, default=5)
+    args = parser.parse_args()
+
+    for name, window in WINDOWS:
+        elapsed, packets, valid = run(args, window)
+        print('{:<16s} {:8.3f} s  {:4d} packets  {:4d} CRC ok'.format(name, elapsed, packets, valid))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,73 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef INCLUDED_LORA_CHANNELIZER_H
+#define INCLUDED_LORA_CHANNELIZER_H
+
+#include <lora/api.h>
+#include <gnuradio/sync_decimator.h>
+
+namespace gr {
+  namespace lora {
+
+    /*!
+     * \brief FFT-based polyphase analysis filterbank
+     * \ingroup lora
+     *
+     * Splits a wideband stream into num_channels critically sampled
+     * channels in one pass: the input is commutated into num_channels
+     * branches of a Kaiser windowed-sinc prototype lowpass
+     * (taps_per_channel taps per branch) and combined by one
+     * num_channels-point FFT per output sample.
+     *
+     * Output c is centered at c*fs/num_channels (outputs above
+     * num_channels/2 are the negative frequencies) and runs at
+     * fs/num_channels. The demodulators need an integer fs_bw_ratio: when
+     * fs/num_channels is an integer multiple of the LoRa bandwidth, connect
+     * each output straight to a demodulator with that ratio. Otherwise put
+     * a rational resampler on each output, e.g. the 200 kHz outputs of
+     * 1.6 MHz into 8 channels need interpolation 5, decimation 4 for
+     * 250 kHz, i.e. fs_bw_ratio 2 at 125 kHz (see
+     * apps/lora_channelizer_benchmark.py).
+     */
+    class LORA_API channelizer : virtual public gr::sync_decimator
+    {
+     public:
+      typedef boost::shared_ptr<channelizer> sptr;
+
+      /*!
+       * \brief Return a shared_ptr to a new instance of lora::channelizer.
+       *
+       * To avoid accidental use of raw pointers, lora::channelizer's
+       * constructor is in a private implementation
+       * class. lora::channelizer::make is the public interface for
+       * creating new instances.
+       */
+      static sptr make( uint16_t  num_channels,
+                        uint16_t  taps_per_channel,
+                        float     beta);
+    };
+
+  } // namespace lora
+} // namespace gr
+
+#endif /* INCLUDED_LORA_CHANNELIZER_H */
+
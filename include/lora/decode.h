@@ -35,6 +35,9 @@ namespace gr {
      * \brief <+description of block+>
      * \ingroup lora
      *
+     * A dict on the "config" port switches any of "sf", "cr", "header", "crc",
+     * "ldr" and "payload_len" for the packets that follow it. Packets tagged
+     * with another "sf" are skipped.
      */
     class LORA_API decode : virtual public gr::block
     {
@@ -31,6 +31,7 @@
 #define LORA_SFD_TOLERANCE         1
 #define LORA_PREAMBLE_TOLERANCE    1
 #define DEMOD_SYNC_RECOVERY_COUNT  (8-REQUIRED_PREAMBLE_CHIRPS)+(2-REQUIRED_SFD_CHIRPS)+8
+#define DEMOD_MAX_CONTEXTS         4
 #define FFT_PEAK_SEARCH_ABS        0
 #define FFT_PEAK_SEARCH_PHASE      1
 #define FFT_PEAK_SEARCH_B          2
@@ -52,6 +53,17 @@ namespace gr {
      * \brief <+description of block+>
      * \ingroup lora
      *
+     * The preamble search never stops: each preamble it finds is synced and
+     * read by its own packet context, up to DEMOD_MAX_CONTEXTS packets
+     * overlapping in time. An explicit header is decoded in place as soon as
+     * its 8th symbol is read, invalid ones drop the packet right away. The
+     * "header" input is unused and only kept for existing flowgraphs.
+     *
+     * A dict on the "config" port switches any of "sf", "cr", "header", "crc",
+     * "ldr" and "payload_len" once no packet is in progress. max_sf
+     * (0: spreading_factor) is the largest spreading factor it may switch to,
+     * the history is sized for it. Tables of every spreading factor used are
+     * kept, so switching back is cheap. Packets carry their "sf".
      */
     class LORA_API demod : virtual public gr::block
     {
@@ -76,7 +88,21 @@ namespace gr {
                         uint16_t  fft_factor,
                         uint8_t   peak_search_algorithm,
                         uint16_t  peak_search_phase_k,
-                        float     fs_bw_ratio);
+                        float     fs_bw_ratio,
+                        uint8_t   max_sf = 0);
+
+      /*!
+       * \brief Skip the spectral work while searching for a preamble on input
+       * that stays less than margin_db above the running noise floor. 0 disables.
+       */
+      virtual void set_squelch(float margin_db) = 0;
+
+      /*!
+       * \brief Also decode each packet block by block while it is received
+       * and publish the frame on "frames", formatted like the output of
+       * lora::decode, as soon as the block holding its last byte is read.
+       */
+      virtual void set_decode_frames(bool enable) = 0;
     };
 
   } // namespace lora
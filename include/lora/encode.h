@@ -33,6 +33,8 @@ namespace gr {
      * \brief <+description of block+>
      * \ingroup lora
      *
+     * A dict on the "config" port switches any of "sf", "cr", "header", "crc"
+     * and "ldr" for the packets that follow it.
      */
     class LORA_API encode : virtual public gr::block
     {
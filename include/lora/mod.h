@@ -25,6 +25,9 @@
 #include <lora/api.h>
 #include <gnuradio/block.h>
 
+#define MOD_OUTPUT_PADDED   0   // zeros around every packet, for simulation
+#define MOD_OUTPUT_BURST    1   // packet samples only, tagged tx_sob/tx_eob (and tx_time)
+
 namespace gr {
   namespace lora {
 
@@ -32,6 +35,18 @@ namespace gr {
      * \brief <+description of block+>
      * \ingroup lora
      *
+     * A dict on the "config" port with an "sf" key switches the spreading
+     * factor for the packets that follow it. The chirp tables of every
+     * spreading factor used are kept, so switching back is cheap.
+     *
+     * Packets wait in a bounded queue and are synthesized straight
+     * into the output buffer as the scheduler asks for samples, fs_bw_ratio
+     * (an integer) samples per chip.
+     *
+     * output_mode MOD_OUTPUT_PADDED surrounds every packet with zeros to kick
+     * the squelch of a simulated receiver. MOD_OUTPUT_BURST emits only the
+     * packet samples, the first tagged tx_sob and the last tx_eob. A "tx_time"
+     * entry in the packet's dict is copied to a tx_time tag on the first sample.
      */
     class LORA_API mod : virtual public gr::block
     {
@@ -46,7 +61,10 @@ namespace gr {
        * class. lora::mod::make is the public interface for
        * creating new instances.
        */
-      static sptr make( short spreading_factor, unsigned char d_sync_word);
+      static sptr make( short spreading_factor,
+                        unsigned char d_sync_word,
+                        float fs_bw_ratio = 1,
+                        uint8_t output_mode = MOD_OUTPUT_PADDED);
     };
 
   } // namespace lora
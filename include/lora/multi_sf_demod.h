@@ -0,0 +1,96 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef INCLUDED_LORA_MULTI_SF_DEMOD_H
+#define INCLUDED_LORA_MULTI_SF_DEMOD_H
+
+#include <lora/api.h>
+#include <gnuradio/block.h>
+
+namespace gr {
+  namespace lora {
+
+    /*!
+     * \brief Demodulate every spreading factor in [min_sf, max_sf] from one input stream
+     * \ingroup lora
+     *
+     * One lora::demod receiver per spreading factor runs on a shared input
+     * window, each with its own packet contexts and batched preamble search.
+     * Emitted packets carry an "sf" key in their dict so that lora::decode
+     * instances can pick their own. An explicit header is decoded in place
+     * as soon as its 8th symbol is read, the "header" input is unused and
+     * only kept for existing flowgraphs. low_data_rate only applies to SF11
+     * and SF12. A dict on the "config" port switches "cr", "header", "crc",
+     * "ldr" and "payload_len" of every spreading factor once no packet is
+     * in progress; "sf" is ignored.
+     *
+     * Every spreading factor searching for a preamble dechirps and FFTs each
+     * of its symbols, so the idle cost grows with the number of spreading
+     * factors. One energy gate, computed once on the input, keeps the search
+     * idle while the input stays less than the squelch margin (1 dB by
+     * default) above the noise floor. Packets that do not raise the input
+     * power by the margin, below about -6 dB SNR over the sample rate at 1 dB,
+     * are missed with the gate on; set_squelch(0) searches every symbol.
+     */
+    class LORA_API multi_sf_demod : virtual public gr::block
+    {
+     public:
+      typedef boost::shared_ptr<multi_sf_demod> sptr;
+
+      /*!
+       * \brief Return a shared_ptr to a new instance of lora::multi_sf_demod.
+       *
+       * To avoid accidental use of raw pointers, lora::multi_sf_demod's
+       * constructor is in a private implementation
+       * class. lora::multi_sf_demod::make is the public interface for
+       * creating new instances.
+       */
+      static sptr make( uint8_t   min_sf,
+                        uint8_t   max_sf,
+                        bool      header,
+                        uint8_t   payload_len,
+                        uint8_t   cr,
+                        bool      crc,
+                        bool      low_data_rate,
+                        uint16_t  fft_factor,
+                        uint8_t   peak_search_algorithm,
+                        uint16_t  peak_search_phase_k,
+                        float     fs_bw_ratio);
+
+      /*!
+       * \brief Skip the preamble search of every spreading factor while the
+       * input stays less than margin_db above the running noise floor.
+       * 0 disables, the default is 1 dB.
+       */
+      virtual void set_squelch(float margin_db) = 0;
+
+      /*!
+       * \brief Also decode each packet block by block while it is received
+       * and publish the frame on "frames", see lora::demod::set_decode_frames.
+       */
+      virtual void set_decode_frames(bool enable) = 0;
+    };
+
+  } // namespace lora
+} // namespace gr
+
+#endif /* INCLUDED_LORA_MULTI_SF_DEMOD_H */
+
@@ -34,6 +34,9 @@
 #define APEX_ALGORITHM_SEGMENT                2
 #define APEX_ALGORITHM                        APEX_ALGORITHM_SEGMENT
 
+#define PY_WINDOW_KAISER              0   // Kaiser window in the time domain, a second FFT per hop
+#define PY_WINDOW_BLACKMAN_HARRIS     1   // 4-term Blackman-Harris derived from the plain spectrum
+
 namespace gr {
   namespace lora {
 
@@ -41,6 +44,13 @@ namespace gr {
      * \brief <+description of block+>
      * \ingroup lora
      *
+     * max_tracks and max_packets cap the peak track and packet pools. The pools
+     * grow on demand up to the cap; beyond it the weakest track or packet is
+     * dropped instead.
+     *
+     * window picks how the windowed spectrum used for peak finding is made:
+     * PY_WINDOW_KAISER (beta) costs one more FFT per hop, PY_WINDOW_BLACKMAN_HARRIS
+     * is a short convolution of the plain spectrum and ignores beta.
      */
     class LORA_API pyramid_demod : virtual public gr::block
     {
@@ -60,7 +70,16 @@ namespace gr {
                         float beta,
                         uint16_t fft_factor,
                         float threshold,
-                        float fs_bw_ratio);
+                        float fs_bw_ratio,
+                        uint16_t max_tracks = 1000,
+                        uint16_t max_packets = 40,
+                        uint8_t window = PY_WINDOW_KAISER);
+
+      /*!
+       * \brief Skip the spectral work while no peak track or packet is open on input
+       * that stays less than margin_db above the running noise floor. 0 disables.
+       */
+      virtual void set_squelch(float margin_db) = 0;
     };
 
   } // namespace lora
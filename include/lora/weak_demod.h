@@ -72,6 +72,13 @@ namespace gr {
                   uint8_t   peak_search_algorithm,
                   uint16_t  peak_search_phase_k,
                   float     fs_bw_ratio);
+
+      /*!
+       * \brief Skip the spectral work while searching for a preamble on input
+       * that stays less than margin_db above the running noise floor. 0 disables.
+       * Packets below the noise floor are gated too, keep it off to receive them.
+       */
+      virtual void set_squelch(float margin_db) = 0;
     };
 
   } // namespace lora
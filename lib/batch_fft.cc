@@ -0,0 +1,120 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <iostream>
+#include <volk/volk.h>
+#include "batch_fft.h"
+
+namespace gr {
+  namespace lora {
+
+    batch_fft::batch_fft(uint32_t num_samples, uint16_t fft_factor, int batch)
+      : d_num_samples(num_samples),
+        d_fft_factor(fft_factor),
+        d_fft_size(fft_factor*num_samples),
+        d_batch(batch)
+    {
+      d_inbuf  = (gr_complex *)fftwf_malloc((size_t)d_num_samples*d_batch*sizeof(gr_complex));
+      d_outbuf = (gr_complex *)fftwf_malloc((size_t)d_fft_size*d_batch*sizeof(gr_complex));
+      d_rotated = d_inbuf;
+      if (d_fft_factor > 1)
+      {
+        d_rotated = (gr_complex *)fftwf_malloc((size_t)d_fft_size*d_batch*sizeof(gr_complex));
+      }
+      if (d_inbuf == NULL || d_outbuf == NULL || d_rotated == NULL)
+      {
+        std::cerr << "Unable to allocate FFT buffer!" << std::endl;
+      }
+
+      // d_twiddle[r*N + n] = exp(-2j*pi*r*n/(fft_factor*N)), row 0 is never used
+      d_twiddle.resize(d_fft_size);
+      for (uint32_t r = 0; r < d_fft_factor; r++)
+      {
+        for (uint32_t n = 0; n < d_num_samples; n++)
+        {
+          d_twiddle[r*d_num_samples + n] = gr_complex(std::polar(1.0, -2*M_PI*r*n/(double)d_fft_size));
+        }
+      }
+
+      d_plans = get_fft_plans(d_num_samples, d_fft_factor, d_batch);
+
+      memset(d_inbuf, 0, (size_t)d_num_samples*d_batch*sizeof(gr_complex));
+    }
+
+    batch_fft::~batch_fft()
+    {
+      if (d_rotated != d_inbuf) fftwf_free(d_rotated);
+      fftwf_free(d_inbuf);
+      fftwf_free(d_outbuf);
+    }
+
+    void
+    batch_fft::rotate(int i)
+    {
+      gr_complex *rot = &d_rotated[(size_t)i*d_fft_size];
+      memcpy(rot, get_inbuf(i), d_num_samples*sizeof(gr_complex));
+      for (uint32_t r = 1; r < d_fft_factor; r++)
+      {
+        volk_32fc_x2_multiply_32fc(&rot[r*d_num_samples], get_inbuf(i), &d_twiddle[r*d_num_samples], d_num_samples);
+      }
+    }
+
+    void
+    batch_fft::execute(int n)
+    {
+      if (n >= d_batch)
+      {
+        if (d_fft_factor > 1)
+        {
+          for (int i = 0; i < d_batch; i++) rotate(i);
+        }
+        fftwf_execute_dft(d_plans->many,
+                          reinterpret_cast<fftwf_complex *>(d_rotated),
+                          reinterpret_cast<fftwf_complex *>(d_outbuf));
+        return;
+      }
+
+      for (int i = 0; i < n; i++)
+      {
+        execute_slot(i);
+      }
+    }
+
+    void
+    batch_fft::execute_slot(int i)
+    {
+      if (d_fft_factor > 1) rotate(i);
+
+      // Slots are a multiple of 2**sf samples apart in one fftwf_malloc block,
+      // so they share the alignment the plans were made for
+      fftwf_execute_dft(d_plans->one,
+                        reinterpret_cast<fftwf_complex *>(&d_rotated[(size_t)i*d_fft_size]),
+                        reinterpret_cast<fftwf_complex *>(get_outbuf(i)));
+    }
+
+  }
+}
@@ -0,0 +1,82 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef BATCH_FFT_H
+#define BATCH_FFT_H
+
+#include <memory>
+#include <vector>
+#include <gnuradio/types.h>
+#include <fftw3.h>
+#include "dsp_registry.h"
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Zero-padded forward FFTs of up to batch() symbols with one FFTW plan.
+     *
+     *  Transform i reads num_samples inputs from get_inbuf(i) and writes the
+     *  fft_factor*num_samples point spectrum of the zero-padded symbol to
+     *  get_outbuf(i). The padding is never stored: output bin fft_factor*k + r
+     *  is bin k of the N-point FFT of the input rotated by exp(-2j*pi*r*n/(fft_factor*N)),
+     *  so each symbol costs fft_factor N-point FFTs instead of one fft_factor*N point FFT.
+     *  execute() runs the whole batch through the plan_many plan, execute(n)
+     *  only the first n symbols and execute_slot(i) only symbol i.
+     *  The plans come from the process-wide registry, so every batch_fft of
+     *  the same layout shares them and only the buffers are per instance.
+     */
+    class batch_fft
+    {
+     public:
+      batch_fft(uint32_t num_samples, uint16_t fft_factor, int batch = 1);
+      ~batch_fft();
+
+      gr_complex *get_inbuf(int i = 0)  { return d_inbuf  + (size_t)i*d_num_samples; }
+      gr_complex *get_outbuf(int i = 0) { return d_outbuf + (size_t)i*d_fft_size; }
+
+      uint32_t fft_size() const { return d_fft_size; }
+      int batch() const { return d_batch; }
+
+      void execute() { execute(d_batch); }
+      void execute(int n);
+      void execute_slot(int i);
+
+     private:
+      void rotate(int i);
+
+      batch_fft(const batch_fft &);
+      batch_fft &operator=(const batch_fft &);
+
+      uint32_t    d_num_samples;
+      uint16_t    d_fft_factor;
+      uint32_t    d_fft_size;
+      int         d_batch;
+      gr_complex *d_inbuf;
+      gr_complex *d_rotated;   // fft_factor rotated copies per symbol, aliases d_inbuf when fft_factor == 1
+      gr_complex *d_outbuf;
+      std::vector<gr_complex> d_twiddle;
+      std::shared_ptr<const fft_plans> d_plans;
+    };
+
+  }
+}
+
+#endif /* BATCH_FFT_H */
@@ -0,0 +1,155 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Microbenchmark of the peak search kernels in peak_search.h for every
+ * spreading factor and a range of FFT oversampling factors.
+ *
+ * Built with -DENABLE_BENCHMARKS=ON.
+ * Usage: benchmark_peak_search [iterations]
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <volk/volk.h>
+#include "peak_search.h"
+
+namespace {
+
+  // The loop the demodulators used before peak_search.h
+  uint32_t scalar_argmax(const float *res, float *p_max_val, uint32_t len)
+  {
+    uint32_t max_idx = 0;
+    *p_max_val = res[0];
+    for (uint32_t i = 1; i < len; i++)
+    {
+      if (res[i] > *p_max_val)
+      {
+        max_idx = i;
+        *p_max_val = res[i];
+      }
+    }
+    return max_idx;
+  }
+
+  template <typename F>
+  double ns_per_call(int iterations, F f)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) f();
+    auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+  }
+
+}
+
+int main(int argc, char **argv)
+{
+  const int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+  const int factors[] = { 1, 2, 4, 8, 16 };
+  const uint32_t k = 4;
+  const uint16_t phase_k = 16;
+
+  std::vector<float> phase_cos, phase_sin;
+  for (int i = 0; i < phase_k; i++)
+  {
+    phase_cos.push_back(std::cos(2*M_PI/phase_k*i));
+    phase_sin.push_back(std::sin(2*M_PI/phase_k*i));
+  }
+  float *scratch = (float *)volk_malloc(gr::lora::phase_search_scratch_len(phase_k)*sizeof(float), volk_get_alignment());
+
+  volatile uint32_t sink = 0;
+  uint32_t top_idx[k];
+  float    top_val[k];
+
+  printf("%4s %6s %8s | %12s %12s %12s %12s %12s %12s %12s   (ns per call)\n",
+         "sf", "factor", "bins", "scalar", "argmax_32f", "mag+argmax", "argmax_mag", "top_4",
+         "phase16_seq", "phase16_fused");
+
+  for (int sf = 7; sf <= 12; sf++)
+  {
+    for (int f : factors)
+    {
+      const uint32_t len = f*(1u << sf);
+
+      gr_complex *spec = (gr_complex *)volk_malloc(2*len*sizeof(gr_complex), volk_get_alignment());
+      gr_complex *sum  = (gr_complex *)volk_malloc(len*sizeof(gr_complex), volk_get_alignment());
+      float      *mag  = (float *)volk_malloc(len*sizeof(float), volk_get_alignment());
+      float      *buf  = (float *)volk_malloc(len*sizeof(float), volk_get_alignment());
+
+      // Noise floor with one dominant bin, as after dechirping a symbol
+      for (uint32_t i = 0; i < 2*len; i++)
+      {
+        spec[i] = gr_complex(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+      }
+      spec[len/3] = gr_complex(100, 0);
+      volk_32fc_magnitude_32f(mag, spec, len);
+
+      float v;
+      double t_scalar = ns_per_call(iterations, [&]() { sink += scalar_argmax(mag, &v, len); });
+      double t_volk   = ns_per_call(iterations, [&]() { sink += gr::lora::argmax_32f(mag, &v, len); });
+      double t_mag    = ns_per_call(iterations, [&]() {
+        volk_32fc_magnitude_32f(buf, spec, len);
+        sink += gr::lora::argmax_32f(buf, &v, len);
+      });
+      double t_magsq  = ns_per_call(iterations, [&]() { sink += gr::lora::argmax_mag_32fc(spec, buf, &v, len); });
+      double t_top_k  = ns_per_call(iterations, [&]() {
+        gr::lora::top_k_32f(mag, len, k, top_idx, top_val);
+        sink += top_idx[0];
+      });
+
+      // FFT_PEAK_SEARCH_PHASE, one rotate/add/magnitude/argmax pass per phase vs. the fused kernel
+      double t_phase_seq = ns_per_call(iterations, [&]() {
+        float best = 0;
+        for (int i = 0; i < phase_k; i++)
+        {
+          volk_32fc_s32fc_multiply_32fc(sum, spec, lv_cmake(phase_cos[i], phase_sin[i]), len);
+          volk_32fc_x2_add_32fc(sum, sum, &spec[len], len);
+          volk_32fc_magnitude_32f(buf, sum, len);
+          uint32_t idx = gr::lora::argmax_32f(buf, &v, len);
+          if (v > best)
+          {
+            best = v;
+            sink += idx;
+          }
+        }
+      });
+      double t_phase_fused = ns_per_call(iterations, [&]() {
+        sink += gr::lora::argmax_phase_sum_32fc(spec, &spec[len], len, &phase_cos[0], &phase_sin[0],
+                                                phase_k, scratch, &v);
+      });
+
+      printf("%4d %6d %8u | %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+             sf, f, len, t_scalar, t_volk, t_mag, t_magsq, t_top_k, t_phase_seq, t_phase_fused);
+
+      volk_free(spec);
+      volk_free(sum);
+      volk_free(mag);
+      volk_free(buf);
+    }
+  }
+
+  volk_free(scratch);
+
+  return 0;
+}
@@ -0,0 +1,146 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gnuradio/io_signature.h>
+#include "channelizer_impl.h"
+
+namespace gr {
+  namespace lora {
+
+    channelizer::sptr
+    channelizer::make(uint16_t num_channels, uint16_t taps_per_channel, float beta)
+    {
+      return gnuradio::get_initial_sptr
+        (new channelizer_impl(num_channels, taps_per_channel, beta));
+    }
+
+    /*
+     * The private constructor
+     */
+    channelizer_impl::channelizer_impl(uint16_t num_channels, uint16_t taps_per_channel, float beta)
+      : gr::sync_decimator("channelizer",
+              gr::io_signature::make(1, 1, sizeof(gr_complex)),
+              gr::io_signature::make(num_channels, num_channels, sizeof(gr_complex)),
+              num_channels),
+        d_num_channels(num_channels),
+        d_taps_per_channel(taps_per_channel)
+    {
+      assert(d_num_channels > 1);
+      assert(d_taps_per_channel > 0);
+
+      const uint32_t M = d_num_channels;
+      const uint32_t T = d_taps_per_channel;
+
+      d_taps  = (float *)volk_malloc(M*T*sizeof(float), volk_get_alignment());
+      d_delay = (gr_complex *)volk_malloc(2*M*T*sizeof(gr_complex), volk_get_alignment());
+      if (d_taps == NULL || d_delay == NULL)
+      {
+        std::cerr << "Unable to allocate processing buffer!" << std::endl;
+      }
+      memset(d_delay, 0, 2*M*T*sizeof(gr_complex));
+      d_widx = T - 1;
+
+      build_taps(beta);
+
+      // y_c = sum_k v_k exp(+j*2*pi*c*k/M), i.e. an unnormalized inverse FFT over the branches
+      d_fft = new fft::fft_complex(M, false, 1);
+    }
+
+    /*
+     * Our virtual destructor.
+     */
+    channelizer_impl::~channelizer_impl()
+    {
+      delete d_fft;
+      volk_free(d_taps);
+      volk_free(d_delay);
+    }
+
+    void
+    channelizer_impl::build_taps(float beta)
+    {
+      // Windowed-sinc prototype lowpass with its -6 dB point at half the channel spacing
+      const uint32_t M = d_num_channels;
+      const uint32_t T = d_taps_per_channel;
+      const uint32_t L = M*T;
+      const double   fc = 0.5 / M;
+      std::vector<float> window = fft::window::build(fft::window::WIN_KAISER, L, beta);
+      std::vector<double> h(L);
+      double gain = 0;
+
+      for (uint32_t n = 0; n < L; n++)
+      {
+        double x = n - (L - 1) / 2.0;
+        h[n] = (x == 0) ? 2*fc : std::sin(2*M_PI*fc*x) / (M_PI*x);
+        h[n] *= window[n];
+        gain += h[n];
+      }
+
+      for (uint32_t k = 0; k < M; k++)
+      {
+        for (uint32_t t = 0; t < T; t++)
+        {
+          d_taps[k*T + t] = h[t*M + k] / gain;
+        }
+      }
+    }
+
+    int
+    channelizer_impl::work (int noutput_items,
+                            gr_vector_const_void_star &input_items,
+                            gr_vector_void_star &output_items)
+    {
+      const gr_complex *in = (const gr_complex *) input_items[0];
+      const uint32_t M = d_num_channels;
+      const uint32_t T = d_taps_per_channel;
+      gr_complex *branch_out = d_fft->get_inbuf();
+
+      for (int i = 0; i < noutput_items; i++)
+      {
+        // Commutator: the newest sample of the block feeds branch 0, the oldest branch M-1
+        for (uint32_t k = 0; k < M; k++)
+        {
+          gr_complex *line = &d_delay[2*k*T];
+          line[d_widx] = line[d_widx + T] = in[M - 1 - k];
+          volk_32fc_32f_dot_prod_32fc(&branch_out[k], &line[d_widx], &d_taps[k*T], T);
+        }
+        d_widx = (d_widx == 0) ? T - 1 : d_widx - 1;
+
+        d_fft->execute();
+
+        const gr_complex *fft_out = d_fft->get_outbuf();
+        for (uint32_t c = 0; c < M; c++)
+        {
+          ((gr_complex *) output_items[c])[i] = fft_out[c];
+        }
+
+        in += M;
+      }
+
+      return noutput_items;
+    }
+
+  } /* namespace lora */
+} /* namespace gr */
+
@@ -0,0 +1,64 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_LORA_CHANNELIZER_IMPL_H
+#define INCLUDED_LORA_CHANNELIZER_IMPL_H
+
+#include <cmath>
+#include <vector>
+#include <complex>
+#include <gnuradio/fft/fft.h>
+#include <gnuradio/fft/window.h>
+#include <volk/volk.h>
+#include <lora/channelizer.h>
+
+namespace gr {
+  namespace lora {
+
+    class channelizer_impl : public channelizer
+    {
+     private:
+      uint16_t d_num_channels;
+      uint16_t d_taps_per_channel;
+
+      // Branch k holds prototype taps h[t*M+k], t = 0..T-1, contiguously
+      float      *d_taps;
+      // Branch delay lines, 2T samples each so that the last T samples are always contiguous
+      gr_complex *d_delay;
+      uint16_t    d_widx;
+
+      fft::fft_complex *d_fft;
+
+      void build_taps(float beta);
+
+     public:
+      channelizer_impl(uint16_t num_channels, uint16_t taps_per_channel, float beta);
+      ~channelizer_impl();
+
+      int work(int noutput_items,
+           gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items);
+    };
+
+  } // namespace lora
+} // namespace gr
+
+#endif /* INCLUDED_LORA_CHANNELIZER_IMPL_H */
+
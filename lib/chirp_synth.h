@@ -0,0 +1,89 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef CHIRP_SYNTH_H
+#define CHIRP_SYNTH_H
+
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <vector>
+#include <gnuradio/types.h>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Table-driven chirp synthesis for one spreading factor at an integer oversampling ratio.
+     *
+     *  A chirp of N = 2**sf chips is symbol_len() = N*os samples long. The
+     *  tables hold two copies of the unshifted up and downchirp, so samples
+     *  [start, start+n) of the upchirp of symbol s (cyclically shifted by s
+     *  chips) are one memcpy from offset s*os + start. At os == 1 the samples
+     *  are the same as those of the per-sample phase accumulator they replace.
+     */
+    class chirp_synth
+    {
+     public:
+      chirp_synth(uint8_t sf, uint16_t os)
+        : d_num_symbols(1 << sf),
+          d_os(os),
+          d_len(d_num_symbols*os)
+      {
+        float phase = -M_PI;
+        double accumulator = 0;
+
+        d_up.resize(2*d_len);
+        d_down.resize(2*d_len);
+        for (uint32_t i = 0; i < d_len; i++)
+        {
+          accumulator += phase/d_os;
+          d_down[i] = d_down[i + d_len] = gr_complex(std::conj(std::polar(1.0, accumulator)));
+          d_up[i]   = d_up[i + d_len]   = gr_complex(std::polar(1.0, accumulator));
+          phase += (2*M_PI)/d_len;
+        }
+      }
+
+      uint32_t num_symbols() const { return d_num_symbols; }
+      uint32_t symbol_len() const { return d_len; }
+
+      // start + n <= symbol_len()
+      void upchirp(gr_complex *out, uint32_t symbol, uint32_t start, uint32_t n) const
+      {
+        memcpy(out, &d_up[(symbol % d_num_symbols)*d_os + start], n*sizeof(gr_complex));
+      }
+
+      void downchirp(gr_complex *out, uint32_t start, uint32_t n) const
+      {
+        memcpy(out, &d_down[start], n*sizeof(gr_complex));
+      }
+
+     private:
+      uint32_t d_num_symbols;
+      uint16_t d_os;
+      uint32_t d_len;
+      std::vector<gr_complex> d_up;
+      std::vector<gr_complex> d_down;
+    };
+
+  }
+}
+
+#endif /* CHIRP_SYNTH_H */
@@ -25,6 +25,8 @@
 #include <bitset>
 #include <lora/decode.h>
 #include "utilities.h"
+#include "phy_config.h"
+#include "stream_decoder.h"
 
 namespace gr {
   namespace lora {
@@ -35,8 +37,7 @@ namespace gr {
       pmt::pmt_t d_in_port;
       pmt::pmt_t d_out_port;
       pmt::pmt_t d_header_port;
-
-      const unsigned char *d_whitening_sequence;
+      pmt::pmt_t d_config_port;
 
       unsigned char d_sf;
       unsigned char d_cr;
@@ -48,9 +49,7 @@ namespace gr {
       uint16_t d_fft_size;
       unsigned char  d_interleaver_size;
 
-      std::vector<uint16_t> d_symbols;
-      std::vector<unsigned char> d_codewords;
-      std::vector<unsigned char> d_bytes;
+      stream_decoder d_decoder;
 
      public:
       decode_impl( short spreading_factor,
@@ -61,18 +60,13 @@ namespace gr {
                    bool  low_data_rate);
       ~decode_impl();
 
-      void to_gray(std::vector<uint16_t> &symbols);
-      void from_gray(std::vector<uint16_t> &symbols);
-      void whiten(std::vector<unsigned char> &codewords);
-      void deinterleave(std::vector<uint16_t> &symbols, std::vector<unsigned char> &codewords, unsigned char ppm, unsigned char rdd);
-      void hamming_decode(std::vector<unsigned char> &codewords, std::vector<unsigned char> &bytes, unsigned char rdd);
-      unsigned char parity(unsigned char c, unsigned char bitmask);
       void print_payload(std::vector<unsigned char> &payload);
 
       void print_bitwise_u8 (std::vector<unsigned char>  &buffer);
       void print_bitwise_u16(std::vector<uint16_t> &buffer);
 
       void decode(pmt::pmt_t msg);
+      void set_config(pmt::pmt_t msg);
 
     };
 
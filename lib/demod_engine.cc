@@ -0,0 +1,823 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2016 Bastille Networks.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "demod_engine.h"
+
+#define DEBUG_OFF     0
+#define DEBUG_INFO    1
+#define DEBUG_VERBOSE 2
+#define DEBUG         DEBUG_OFF
+
+#define DUMP_IQ       0
+
+#define OVERLAP_DEFAULT 1
+#define OVERLAP_FACTOR  16
+
+#define FFT_BATCH_MAX   16          // symbols per batched FFT
+#define FFT_BATCH_BYTES (256*1024)  // keep a batch within L2
+
+namespace gr {
+  namespace lora {
+
+    demod_sf_tables::demod_sf_tables(uint8_t sf, uint16_t p, uint16_t fft_factor, float beta)
+      : fft(p*(1 << sf), fft_factor),
+        batch(p*(1 << sf), fft_factor,
+          std::max(1, std::min(FFT_BATCH_MAX, (int)(FFT_BATCH_BYTES / (fft_factor*p*(1 << sf)*sizeof(gr_complex)))))),
+        ctx(p*(1 << sf), fft_factor, DEMOD_MAX_CONTEXTS),
+        chirps(get_chirp_tables(sf, p, beta))
+    {
+    }
+
+    demod_engine::demod_engine(gr::block      *block,
+                               pmt::pmt_t      out_port,
+                               pmt::pmt_t      frames_port,
+                               const phy_config &cfg,
+                               uint8_t         max_sf,
+                               uint16_t        p,
+                               uint16_t        fft_factor,
+                               float           beta,
+                               uint8_t         peak_search_algorithm,
+                               uint16_t        peak_search_phase_k)
+      : d_block(block),
+        d_out_port(out_port),
+        d_frames_port(frames_port),
+        d_sf(cfg.sf),
+        d_header(cfg.header),
+        d_payload_len(cfg.payload_len),
+        d_cr(cfg.cr),
+        d_crc(cfg.crc),
+        d_ldr(cfg.ldr),
+        d_beta(beta),
+        d_p(p),
+        d_fft_size_factor(fft_factor),
+        d_peak_search_algorithm(peak_search_algorithm),
+        d_peak_search_phase_k(peak_search_phase_k),
+        d_reconfig(false),
+        d_decode_frames(false),
+        d_pos(0),
+        d_gated(false),
+        d_dropped_packets(0)
+    {
+      assert(max_sf >= d_sf && max_sf < 13);
+
+      #if DUMP_IQ
+        f_raw.open("raw.out", std::ios::out);
+        f_fft.open("fft.out", std::ios::out);
+        f_up_windowless.open("up_windowless.out", std::ios::out);
+        f_up.open("up.out", std::ios::out);
+        f_down.open("down.out", std::ios::out);
+      #endif
+
+      d_state = S_RESET;
+
+      d_overlaps = OVERLAP_DEFAULT;
+      d_offset = 0;
+
+      // Buffers are sized for max_sf so that switching spreading factor never reallocates them
+      const uint32_t max_bin_size = d_fft_size_factor*(1 << max_sf);
+      const uint32_t max_fft_size = d_p*max_bin_size;
+
+      // Nomenclature:
+      //  up_block   == de-chirping buffer to contain upchirp features: the preamble, sync word, and data chirps
+      //  down_block == de-chirping buffer to contain downchirp features: the SFD
+      d_up_block      = d_ws.alloc<gr_complex>(max_fft_size);
+      d_down_block    = d_ws.alloc<gr_complex>(max_fft_size);
+      d_fft_res_mag   = d_ws.alloc<float>(max_fft_size);
+      d_fft_res_add   = d_ws.alloc<float>(max_bin_size);
+      d_fft_res_add_c = d_ws.alloc<gr_complex>(max_bin_size);
+      d_phase_scratch = d_ws.alloc<float>(gr::lora::phase_search_scratch_len(d_peak_search_phase_k));
+      d_ws.seal();
+
+      for (int i = 0; i < d_peak_search_phase_k; i++)
+      {
+        float phase_offset = 2*M_PI/d_peak_search_phase_k*i;
+        d_phase_cos.push_back(std::cos(phase_offset));
+        d_phase_sin.push_back(std::sin(phase_offset));
+      }
+
+      d_argmax_history.reset(REQUIRED_PREAMBLE_CHIRPS);
+      d_contexts.resize(DEMOD_MAX_CONTEXTS);
+      d_due.resize(DEMOD_MAX_CONTEXTS);
+      d_batch_slot.resize(FFT_BATCH_MAX);
+      d_batch_replay.resize(FFT_BATCH_MAX);
+      for (auto & ctx : d_contexts)
+      {
+        ctx.state = S_RESET;
+      }
+      // header, 255 byte payload, CRC and the CRC check flag
+      d_frame.reserve(3 + 255 + 2 + 1);
+      select_sf(d_sf);
+    }
+
+    demod_engine::~demod_engine()
+    {
+      #if DEBUG >= DEBUG_INFO
+        std::cout << "[SF" << int(d_sf) << "] workspace buffers allocated after construction: " << d_ws.late_allocations() << std::endl;
+        std::cout << "[SF" << int(d_sf) << "] spreading factor tables built: " << d_tables.built() << std::endl;
+        std::cout << "[SF" << int(d_sf) << "] packets dropped with every context busy: " << d_dropped_packets << std::endl;
+      #endif
+    }
+
+    uint32_t
+    demod_engine::calc_packet_symbol_len(const demod_context &ctx)
+    {
+      return 8 + std::max((4+ctx.cr)*(int)std::ceil((2.0*ctx.payload_len-d_sf+7+4*ctx.crc-5*!d_header)/(d_sf-2*d_ldr)), 0);
+    }
+
+    void
+    demod_engine::select_sf(uint8_t sf)
+    {
+      d_sf          = sf;
+      d_num_symbols = (1 << d_sf);
+      d_num_samples = d_p*d_num_symbols;
+      d_bin_size    = d_fft_size_factor*d_num_symbols;
+      d_fft_size    = d_fft_size_factor*d_num_samples;
+      d_preamble_drift_max = d_fft_size_factor * (d_ldr ? 2 : 1);
+
+      demod_sf_tables &tables = d_tables.get(d_sf, [this](uint8_t sf) {
+        return new demod_sf_tables(sf, d_p, d_fft_size_factor, d_beta);
+      });
+      d_fft         = &tables.fft;
+      d_batch_fft   = &tables.batch;
+      d_ctx_fft     = &tables.ctx;
+      d_window      = tables.chirps->window.data();
+      d_upchirp     = tables.chirps->upchirp.data();
+      d_downchirp   = tables.chirps->downchirp.data();
+
+      // Lower spreading factors have longer packets, only ever grow the symbol buffers
+      uint32_t max_len = gr::lora::max_packet_symbol_len(d_sf, d_ldr);
+      for (auto & ctx : d_contexts)
+      {
+        ctx.symbols.reserve(max_len);
+      }
+    }
+
+    void
+    demod_engine::apply_config()
+    {
+      const phy_config &cfg = d_pending_config;
+      d_reconfig = false;
+
+      d_cr          = cfg.cr;
+      d_header      = cfg.header;
+      d_crc         = cfg.crc;
+      d_payload_len = cfg.payload_len;
+      if (cfg.sf != d_sf || cfg.ldr != d_ldr)
+      {
+        d_ldr = cfg.ldr;
+        select_sf(cfg.sf);
+      }
+
+      d_state = S_RESET;
+
+      #if DEBUG >= DEBUG_INFO
+        std::cout << "Reconfigured: sf " << int(d_sf) << ", cr " << int(d_cr) << ", header " << d_header
+                  << ", crc " << d_crc << ", ldr " << d_ldr << std::endl;
+      #endif
+    }
+
+    void
+    demod_engine::configure(const phy_config &cfg)
+    {
+      d_pending_config = cfg;
+      d_reconfig       = true;
+    }
+
+    phy_config
+    demod_engine::config() const
+    {
+      // Later changes build on one that is still pending
+      if (d_reconfig)
+      {
+        return d_pending_config;
+      }
+      phy_config cfg;
+      cfg.sf          = d_sf;
+      cfg.cr          = d_cr;
+      cfg.header      = d_header;
+      cfg.crc         = d_crc;
+      cfg.ldr         = d_ldr;
+      cfg.payload_len = d_payload_len;
+      return cfg;
+    }
+
+    void
+    demod_engine::work(const gr_complex *in, uint64_t nread, uint64_t end, search_gate &gate)
+    {
+      // A config takes effect between packets, before the window size is taken
+      if (d_reconfig && between_packets())
+      {
+        apply_config();
+      }
+
+      if (d_pos + d_num_samples > end)
+      {
+        return;
+      }
+      const int lookback = (DEMOD_HISTORY_DEPTH-1)*d_num_samples;
+
+      // The search always hops one symbol, so its FFTs are computed ahead in one batch.
+      // The gate is checked for every window of the batch first, only open windows are transformed.
+      // A pending config ends the search at the next packet boundary, so it goes one window at a time.
+      const int batch_len = d_reconfig ? 1 : std::min<uint64_t>(d_batch_fft->batch(), (end - d_pos) / d_num_samples);
+      int num_open = 0;
+      for (int i = 0; i < batch_len; i++)
+      {
+        const uint64_t pos = d_pos + i*d_num_samples;
+        // S_RESET only ever precedes the first window, detect() leaves it right away
+        if (gate.enabled() && (i > 0 || d_state != S_RESET) && !gate.open(in, nread, pos, d_num_samples))
+        {
+          d_batch_slot[i] = -1;
+          d_gated = true;
+          continue;
+        }
+        d_batch_replay[i] = d_gated;
+        d_gated = false;
+        d_batch_slot[i] = num_open;
+        dechirp_up(&symbol_in0(in, nread, pos)[lookback], d_batch_fft->get_inbuf(num_open++));
+      }
+      if (num_open > 0)
+      {
+        d_batch_fft->execute(num_open);
+      }
+
+      for (int i = 0; i < batch_len; i++)
+      {
+        // Packets are stepped up to the search window first, a preamble found there starts a context at most a symbol ahead
+        step_contexts(in, nread, d_pos);
+
+        // Windows that stay closed skip the preamble search FFT
+        if (d_batch_slot[i] < 0)
+        {
+          d_pos += d_num_samples;
+          continue;
+        }
+        if (d_batch_replay[i])
+        {
+          replay_preamble_history(symbol_in0(in, nread, d_pos));
+        }
+        const lv_32fc_t *up_fft = d_batch_fft->get_outbuf(d_batch_slot[i]);
+
+        #if DUMP_IQ
+          f_fft.write((const char*)up_fft, d_fft_size*sizeof(gr_complex));
+        #endif
+
+        detect(up_fft);
+        d_pos += d_num_samples;
+      }
+    }
+
+    uint64_t
+    demod_engine::min_pos() const
+    {
+      uint64_t min_pos = d_pos;
+      for (auto & ctx : d_contexts)
+      {
+        if (ctx.state != S_RESET)
+        {
+          min_pos = std::min(min_pos, ctx.pos);
+        }
+      }
+      return min_pos;
+    }
+
+    uint32_t
+    demod_engine::search_fft_peak(const lv_32fc_t *fft_result,
+                                float *buffer1, float *buffer2,
+                                gr_complex *buffer_c, float *max_val_p)
+    {
+      // size of buffer1:   d_fft_size (float)
+      // size of buffer2:   d_bin_size  (float)
+      // size of buffer_c:  d_bin_size  (complex)
+      uint32_t max_idx = 0;
+      *max_val_p = 0;
+      if (d_peak_search_algorithm == FFT_PEAK_SEARCH_ABS)
+      {
+        // fft result magnitude summation
+        volk_32fc_magnitude_32f(buffer1, fft_result, d_fft_size);
+        volk_32f_x2_add_32f(buffer2, buffer1, &buffer1[d_fft_size-d_bin_size], d_bin_size);
+
+        // Take argmax of returned FFT (similar to MFSK demod)
+        max_idx = gr::lora::argmax_32f(buffer2, max_val_p, d_bin_size);
+      }
+      else if (d_peak_search_algorithm == FFT_PEAK_SEARCH_PHASE)
+      {
+        // all d_peak_search_phase_k phase offsets in one pass over the spectrum
+        max_idx = gr::lora::argmax_phase_sum_32fc(fft_result, &fft_result[d_fft_size-d_bin_size], d_bin_size,
+                                                  d_phase_cos.data(), d_phase_sin.data(), d_peak_search_phase_k,
+                                                  d_phase_scratch, max_val_p);
+      }
+      else
+      {
+        max_idx = fft_add(fft_result, buffer2, buffer_c, max_val_p, 0);
+      }
+      
+      return max_idx;
+    }
+
+    uint32_t
+    demod_engine::fft_add(const lv_32fc_t *fft_result, float *buffer, gr_complex *buffer_c,
+                        float *max_val_p, float phase_offset)
+    {
+      lv_32fc_t s = lv_cmake((float)std::cos(phase_offset), (float)std::sin(phase_offset));
+      volk_32fc_s32fc_multiply_32fc(buffer_c, fft_result, s, d_bin_size);
+      volk_32fc_x2_add_32fc(buffer_c, buffer_c, &fft_result[d_fft_size-d_bin_size], d_bin_size);
+      return gr::lora::argmax_mag_32fc(buffer_c, buffer, max_val_p, d_bin_size);
+    }
+
+    void
+    demod_engine::push_symbol(demod_context &ctx, float v)
+    {
+      const float modulus = 4.0;
+      if (ctx.symbols.empty())
+      {
+        ctx.bin_comp = 0;
+        ctx.v_last   = 1;
+      }
+
+      float bin_drift = gr::lora::fpmod(v - ctx.v_last, modulus);
+
+      // compensate bin drift
+      if (bin_drift < modulus / 2) ctx.bin_comp -= bin_drift;
+      else ctx.bin_comp -= (bin_drift - modulus);
+      ctx.bin_comp = d_ldr ? ctx.bin_comp : 0;
+      ctx.v_last = v;
+      ctx.symbols.push_back(gr::lora::pmod(round(gr::lora::fpmod(v + ctx.bin_comp, d_num_symbols)), d_num_symbols));
+    }
+
+    void
+    demod_engine::push_block(demod_context &ctx)
+    {
+      // The header block went in with the 8th symbol, every later block once its last symbol is read
+      if (ctx.symbols.size() > 8)
+      {
+        uint32_t block_len = ctx.decoder.block_len();
+        if (ctx.decoder.done() || (ctx.symbols.size() - 8) % block_len != 0)
+        {
+          return;
+        }
+        ctx.decoder.push_block(&ctx.symbols[ctx.symbols.size() - block_len]);
+      }
+
+      if (ctx.decoder.done())
+      {
+        d_frame.assign(ctx.decoder.bytes().begin(), ctx.decoder.bytes().end());
+        if (ctx.crc)
+        {
+          d_frame.push_back(ctx.decoder.crc_ok());
+        }
+        pmt::pmt_t output = pmt::init_u8vector(d_frame.size(), d_frame);
+        d_block->message_port_pub(d_frames_port, pmt::cons(pmt::make_dict(), output));
+
+        #if DEBUG >= DEBUG_INFO
+          std::cout << "Frame decoded after " << ctx.symbols.size() << " symbols" << std::endl;
+        #endif
+      }
+    }
+
+    void
+    demod_engine::dechirp_up(const gr_complex *in, gr_complex *fft_in)
+    {
+      // Dechirp the incoming signal
+      volk_32fc_x2_multiply_32fc(fft_in, in, &d_downchirp[0], d_num_samples);
+
+      // Windowing
+      // volk_32fc_32f_multiply_32fc(fft_in, fft_in, &d_window[0], d_num_samples);
+
+      // Enable to write IQ to disk for debugging
+      #if DUMP_IQ
+        f_up.write((const char*)&fft_in[0], d_num_samples*sizeof(gr_complex));
+      #endif
+    }
+
+    bool
+    demod_engine::between_packets() const
+    {
+      for (auto & ctx : d_contexts)
+      {
+        if (ctx.state != S_RESET)
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    void
+    demod_engine::replay_preamble_history(const gr_complex *in0)
+    {
+      // The symbols skipped right before the gate opened are still in the lookback,
+      // their peaks let a preamble that started under the gate be detected on time
+      float max_val;
+      d_argmax_history.clear();
+      for (int i = REQUIRED_PREAMBLE_CHIRPS-1; i > 0; i--)
+      {
+        dechirp_up(&in0[(DEMOD_HISTORY_DEPTH-1-i)*d_num_samples], d_fft->get_inbuf());
+        d_fft->execute();
+        d_argmax_history.push_back(search_fft_peak(d_fft->get_outbuf(), d_fft_res_mag, d_fft_res_add, d_fft_res_add_c, &max_val));
+      }
+    }
+
+    void
+    demod_engine::detect(const lv_32fc_t *up_fft)
+    {
+      uint32_t max_idx        = 0;
+      bool     preamble_found = false;
+      float    max_val        = 0;
+
+      // Take argmax of returned FFT (similar to MFSK demod)
+      max_idx = search_fft_peak(up_fft, d_fft_res_mag, d_fft_res_add, d_fft_res_add_c, &max_val);
+
+      // Keeps the last REQUIRED_PREAMBLE_CHIRPS peaks, recent(0) is the newest
+      d_argmax_history.push_back(max_idx);
+
+      switch (d_state) {
+      case S_RESET:
+      {
+        d_overlaps = OVERLAP_DEFAULT;
+        d_offset = 0;
+        d_argmax_history.clear();
+        d_sfd_history.clear();
+
+        d_state = S_PREFILL;
+
+        #if DEBUG >= DEBUG_INFO
+          std::cout << "Next state: S_PREFILL" << std::endl;
+        #endif
+
+        break;
+      }
+
+
+
+      case S_PREFILL:
+      {
+        if (d_argmax_history.size() >= REQUIRED_PREAMBLE_CHIRPS)
+        {
+          d_state = S_DETECT_PREAMBLE;
+
+          #if DEBUG >= DEBUG_INFO
+            std::cout << "Next state: S_DETECT_PREAMBLE" << std::endl;
+          #endif
+        }
+        break;
+      }
+
+
+
+      // Looks for the same symbol appearing consecutively, signifying the LoRa preamble
+      case S_DETECT_PREAMBLE:
+      {
+        d_preamble_idx = d_argmax_history.recent(0);
+
+        #if DEBUG >= DEBUG_VERBOSE
+          std::cout << "PREAMBLE " << d_argmax_history.recent(0) << std::endl;
+        #endif
+
+        // Check for discontinuities that exceed some tolerance
+        preamble_found = true;
+        for (int i = 1; i < REQUIRED_PREAMBLE_CHIRPS; i++)
+        {
+          uint32_t dis = gr::lora::pmod(int(d_preamble_idx) - int(d_argmax_history.recent(i)), d_bin_size);
+          if (dis > d_preamble_drift_max && dis < d_bin_size-d_preamble_drift_max)
+          {
+            preamble_found = false;
+          }
+        }
+
+        // Hand a contiguous preamble to a context for SFD/sync discovery, the search goes on
+        if (preamble_found)
+        {
+          // move preamble peak to bin zero
+          spawn_context(d_pos + d_num_samples - d_p*d_preamble_idx/d_fft_size_factor);
+        }
+        break;
+      }
+
+
+
+      default:
+        break;
+      }
+    }
+
+    void
+    demod_engine::spawn_context(uint64_t pos)
+    {
+      const uint32_t tolerance = d_p*(d_ldr ? 2 : 1);
+      demod_context *free_ctx  = NULL;
+
+      for (auto & ctx : d_contexts)
+      {
+        if (ctx.state == S_SFD_SYNC)
+        {
+          // Later chirps of a preamble that already has a context
+          uint32_t dis = gr::lora::pmod(int64_t(pos) - int64_t(ctx.pos), d_num_samples);
+          if (dis <= tolerance || dis >= d_num_samples-tolerance)
+          {
+            return;
+          }
+        }
+        else if (ctx.state == S_RESET && free_ctx == NULL)
+        {
+          free_ctx = &ctx;
+        }
+      }
+
+      if (free_ctx == NULL)
+      {
+        d_dropped_packets++;
+
+        #if DEBUG >= DEBUG_INFO
+          std::cout << "Every context is busy, preamble dropped" << std::endl;
+        #endif
+
+        return;
+      }
+
+      demod_context &ctx = *free_ctx;
+      ctx.state                 = S_SFD_SYNC;
+      ctx.pos                   = pos;
+      ctx.sync_recovery_counter = 0;
+      ctx.cr                    = d_cr;
+      ctx.payload_len           = d_payload_len;
+      ctx.crc                   = d_crc;
+      // implicit header mode, an explicit header replaces it in S_READ_HEADER
+      ctx.packet_symbol_len     = calc_packet_symbol_len(ctx);
+      ctx.symbols.clear();
+
+      #if DEBUG >= DEBUG_INFO
+        std::cout << "Context " << (free_ctx - &d_contexts[0]) << " at " << pos << ", next state: S_SFD_SYNC" << std::endl;
+      #endif
+    }
+
+    void
+    demod_engine::step_contexts(const gr_complex *in, uint64_t nread, uint64_t until)
+    {
+      const int lookback = (DEMOD_HISTORY_DEPTH-1)*d_num_samples;
+
+      // The symbols of all contexts due before until go through one batched FFT,
+      // repeated for the contexts that are still short of it
+      while (true)
+      {
+        int num_due = 0;
+        for (int i = 0; i < d_contexts.size(); i++)
+        {
+          if (d_contexts[i].state != S_RESET && d_contexts[i].pos < until)
+          {
+            dechirp_up(&symbol_in0(in, nread, d_contexts[i].pos)[lookback], d_ctx_fft->get_inbuf(num_due));
+            d_due[num_due++] = i;
+          }
+        }
+        if (num_due == 0)
+        {
+          break;
+        }
+        d_ctx_fft->execute(num_due);
+
+        for (int j = 0; j < num_due; j++)
+        {
+          demod_context &ctx = d_contexts[d_due[j]];
+          ctx.pos += step(ctx, symbol_in0(in, nread, ctx.pos), d_ctx_fft->get_outbuf(j));
+        }
+      }
+    }
+
+    uint32_t
+    demod_engine::step(demod_context &ctx, const gr_complex *in0, const lv_32fc_t *up_fft)
+    {
+      const gr_complex *in  = &in0[(DEMOD_HISTORY_DEPTH-1)*d_num_samples];
+
+      uint32_t num_consumed   = d_num_samples;
+      uint32_t max_idx        = 0;
+      uint32_t max_idx_sfd    = 0;
+      float        max_val        = 0;
+      float        max_val_sfd    = 0;
+
+      gr_complex *up_block      = d_up_block;
+      gr_complex *down_block    = d_down_block;
+      float      *fft_res_mag   = d_fft_res_mag;
+      float      *fft_res_add   = d_fft_res_add;
+      gr_complex *fft_res_add_c = d_fft_res_add_c;
+
+      // Take argmax of returned FFT (similar to MFSK demod)
+      max_idx = search_fft_peak(up_fft, fft_res_mag, fft_res_add, fft_res_add_c, &max_val);
+
+      switch (ctx.state) {
+      // Accurately synchronize to the SFD by computing overlapping FFTs of the downchirp/SFD IQ stream
+      // Effectively increases FFT's time-based resolution, allowing for a better sync
+      case S_SFD_SYNC:
+      {
+        d_overlaps = OVERLAP_FACTOR;
+
+        // Recover if the SFD is missed, or if we wind up in this state erroneously (false positive on preamble)
+        if (ctx.sync_recovery_counter++ > DEMOD_SYNC_RECOVERY_COUNT)
+        {
+          ctx.state = S_RESET;
+          d_overlaps = OVERLAP_DEFAULT;
+
+          #if DEBUG >= DEBUG_INFO
+            std::cout << "Bailing out of sync loop"   << std::endl;
+            std::cout << "Next state: S_RESET" << std::endl;
+          #endif
+        }
+
+        // Dechirp
+        volk_32fc_x2_multiply_32fc(down_block, in, &d_upchirp[0], d_num_samples);
+
+        // Enable to write out overlapped chirps to disk for debugging
+        #if DUMP_IQ
+          f_down.write((const char*)&down_block[0], d_num_samples*sizeof(gr_complex));
+        #endif
+
+        memcpy(d_fft->get_inbuf(), down_block, d_num_samples*sizeof(gr_complex));
+        d_fft->execute();
+
+        // Take argmax of downchirp FFT
+        max_idx_sfd = search_fft_peak(d_fft->get_outbuf(), fft_res_mag, fft_res_add, fft_res_add_c, &max_val_sfd);
+
+        // If SFD is detected
+        if (max_val_sfd > max_val)
+        {
+          int idx = max_idx_sfd;
+          if (max_idx_sfd > d_bin_size / 2) {
+            idx = max_idx_sfd - d_bin_size;
+          }
+          num_consumed = (int)round(2.25*d_num_samples + d_p*idx/2.0/d_fft_size_factor);
+
+          // refine CFO
+          volk_32fc_x2_multiply_32fc(up_block, 
+            &in0[(int)round((DEMOD_HISTORY_DEPTH-1-5.25)*d_num_samples) + num_consumed],
+            &d_downchirp[0], d_num_samples);
+          memcpy(d_fft->get_inbuf(), up_block, d_num_samples*sizeof(gr_complex));
+          d_fft->execute();
+          ctx.cfo = (float)search_fft_peak(d_fft->get_outbuf(), fft_res_mag, fft_res_add, fft_res_add_c, &max_val);
+
+          ctx.state = S_READ_HEADER;
+
+          #if DEBUG >= DEBUG_INFO
+            std::cout << "Next state: S_READ_HEADER" << std::endl;
+            std::cout << "CFO: " << ctx.cfo << std::endl;
+          #endif
+
+          break;
+        }
+
+        break;
+      }
+
+
+
+      case S_READ_HEADER:
+      {
+        /* Preamble + modulo operation normalizes the symbols about the preamble; preamble symbol == value 0
+         * Dividing by d_fft_size_factor reduces symbols to [0:(2**sf)-1] range
+         * Dividing by 4 to further reduce symbol set to [0:(2**(sf-2)-1)], since header is sent at SF-2
+         */
+        float bin_idx = gr::lora::fpmod((max_idx - ctx.cfo)/(float)d_fft_size_factor, d_num_symbols);
+        #if DEBUG >= DEBUG_INFO
+          std::cout << "MIDX: " << bin_idx << ", MV: " << max_val << std::endl;
+        #endif
+        push_symbol(ctx, bin_idx);
+
+        if (ctx.symbols.size() == 8)   // Symbols [0:7] contain 2**(SF-2) bits/symbol, symbols [8:] have the full 2**(SF) bits
+        {
+          ctx.state = S_READ_PAYLOAD;
+
+          // The header is decoded in place, so the packet length is known before the next symbol
+          ctx.decode_frame = d_decode_frames;
+          if (d_header || ctx.decode_frame)
+          {
+            ctx.decoder.reset(d_sf, d_header, d_ldr, ctx.cr, ctx.crc, ctx.payload_len);
+            ctx.decoder.push_block(&ctx.symbols[0]);
+          }
+
+          if (d_header)
+          {
+            const lora_header &header = ctx.decoder.header();
+            if (header.valid)
+            {
+              ctx.payload_len       = header.payload_len;
+              ctx.cr                = header.cr;
+              ctx.crc               = header.crc;
+              ctx.packet_symbol_len = calc_packet_symbol_len(ctx);
+            }
+            else
+            {
+              ctx.state = S_RESET;
+            }
+
+            #if DEBUG >= DEBUG_INFO
+              std::cout << "HEADER " << (header.valid ? "valid" : "invalid") << std::endl;
+              std::cout << "payload_len: " << int(ctx.payload_len) << std::endl;
+              std::cout << "cr: " << int(ctx.cr) << std::endl;
+              std::cout << "crc: " << int(ctx.crc) << std::endl;
+              std::cout << "packet_symbol_len: " << int(ctx.packet_symbol_len) << std::endl;
+            #endif
+          }
+
+          if (ctx.decode_frame && ctx.state == S_READ_PAYLOAD)
+          {
+            push_block(ctx);
+          }
+
+          #if DEBUG >= DEBUG_INFO
+            std::cout << "Next state: " << (ctx.state == S_RESET ? "S_RESET" : "S_READ_PAYLOAD") << std::endl;
+          #endif
+        }
+
+        break;
+      }
+
+
+      case S_READ_PAYLOAD:
+      {
+        if (ctx.symbols.size() >= ctx.packet_symbol_len)
+        {
+          ctx.state = S_OUT;
+
+          #if DEBUG >= DEBUG_INFO
+            std::cout << "Next state: S_OUT" << std::endl;
+          #endif
+        }
+        else {
+          /* Preamble + modulo operation normalizes the symbols about the preamble; preamble symbol == value 0
+          * Dividing by d_fft_size_factor reduces symbols to [0:(2**sf)-1] range
+          */
+          float bin_idx = gr::lora::fpmod((max_idx - ctx.cfo)/(float)d_fft_size_factor, d_num_symbols);
+          #if DEBUG >= DEBUG_INFO
+            std::cout << "MIDX: " << bin_idx << ", MV: " << max_val << std::endl;
+          #endif
+          push_symbol(ctx, bin_idx);
+          if (ctx.decode_frame)
+          {
+            push_block(ctx);
+          }
+        }
+
+        break;
+      }
+
+
+
+      // Emit a PDU to the decoder and free the context
+      case S_OUT:
+      {
+        pmt::pmt_t output = pmt::init_u16vector(ctx.symbols.size(), ctx.symbols);
+        pmt::pmt_t dict = pmt::make_dict();
+        dict = pmt::dict_add(dict, pmt::intern("id"), pmt::intern("packet"));
+        // lets lora::decode skip packets sent before it followed a spreading factor change
+        dict = pmt::dict_add(dict, pmt::intern("sf"), pmt::from_long(d_sf));
+        pmt::pmt_t msg_pair = pmt::cons(dict, output);
+        d_block->message_port_pub(d_out_port, msg_pair);
+
+        ctx.state = S_RESET;
+        #if DEBUG >= DEBUG_INFO
+          std::cout << "Next state: S_RESET" << std::endl;
+          std::cout << "symbols size: " << ctx.symbols.size() << std::endl;
+          std::cout << "compensated_symbols: ";
+          for (auto i: ctx.symbols) {
+            std::cout << i << " ";
+          }
+          std::cout << std::endl;
+        #endif
+
+        break;
+      }
+
+
+
+      default:
+        break;
+      }
+
+      #if DUMP_IQ
+        f_raw.write((const char*)&in[0], num_consumed*sizeof(gr_complex));
+      #endif
+
+      return num_consumed;
+    }
+
+  } /* namespace lora */
+} /* namespace gr */
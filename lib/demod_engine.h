@@ -0,0 +1,239 @@
+/* -*- c++ -*- */
+/* 
+ * Copyright 2016 Bastille Networks.
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DEMOD_ENGINE_H
+#define DEMOD_ENGINE_H
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <complex>
+#include <fstream>
+#include <gnuradio/block.h>
+#include <volk/volk.h>
+#include "lora/demod.h"
+#include "utilities.h"
+#include "peak_search.h"
+#include "workspace.h"
+#include "ring_buffer.h"
+#include "batch_fft.h"
+#include "dsp_registry.h"
+#include "sf_cache.h"
+#include "phy_config.h"
+#include "stream_decoder.h"
+
+namespace gr {
+  namespace lora {
+
+    // FFT buffers, chirp tables and window of one spreading factor, plans and tables are shared process-wide
+    struct demod_sf_tables
+    {
+      demod_sf_tables(uint8_t sf, uint16_t p, uint16_t fft_factor, float beta);
+
+      batch_fft                           fft;
+      batch_fft                           batch;
+      batch_fft                           ctx;      // one slot per packet context
+      std::shared_ptr<const chirp_tables> chirps;
+    };
+
+    // One packet from its preamble to the emitted PDU, several run at their own offsets
+    struct demod_context
+    {
+      demod_state_t state;              // S_RESET while the context is free
+      uint64_t pos;                     // absolute stream index of the next symbol window
+      float    cfo;
+      uint16_t sync_recovery_counter;
+      uint8_t  cr;
+      uint8_t  payload_len;
+      bool     crc;
+      uint32_t packet_symbol_len;
+      float    bin_comp;                // bin drift compensation so far, low data rate only
+      float    v_last;
+      std::vector<uint16_t> symbols;    // compensated symbols, as emitted on "out"
+      bool     decode_frame;            // d_decode_frames when the header block was read
+      stream_decoder decoder;           // fed one interleaver block at a time
+    };
+
+    /**
+     *  \brief  Decides which preamble search windows are worth an FFT.
+     *
+     *  in points at the sample at stream index nread, with the block history
+     *  in front of it. A demod_engine asks for its windows in stream order.
+     */
+    class search_gate
+    {
+     public:
+      virtual ~search_gate() {}
+
+      virtual bool enabled() const = 0;
+      virtual bool open(const gr_complex *in, uint64_t nread, uint64_t pos, uint32_t n) = 0;
+    };
+
+    /**
+     *  \brief  The lora::demod receiver of one input stream, without the block around it.
+     *
+     *  The preamble search hops one symbol at a time through batched FFTs and
+     *  hands each preamble to a packet context, which syncs to the SFD, reads
+     *  the packet and publishes it on out_port of block (and the decoded
+     *  frame on frames_port). The caller owns the input window: it has to
+     *  keep DEMOD_HISTORY_DEPTH symbols of max_sf in front of min_pos().
+     */
+    class demod_engine
+    {
+     public:
+      demod_engine(gr::block      *block,
+                   pmt::pmt_t      out_port,
+                   pmt::pmt_t      frames_port,
+                   const phy_config &cfg,
+                   uint8_t         max_sf,
+                   uint16_t        p,
+                   uint16_t        fft_factor,
+                   float           beta,
+                   uint8_t         peak_search_algorithm,
+                   uint16_t        peak_search_phase_k);
+      ~demod_engine();
+
+      // Runs at most one batch of the preamble search, and the packets up to it,
+      // on the input up to stream index end. in points at the sample at nread.
+      void work(const gr_complex *in, uint64_t nread, uint64_t end, search_gate &gate);
+
+      // cfg takes effect once no packet is in progress
+      void configure(const phy_config &cfg);
+      phy_config config() const;
+      void set_decode_frames(bool enable) { d_decode_frames = enable; }
+
+      uint8_t  sf() const { return d_sf; }
+      uint32_t num_samples() const { return d_num_samples; }
+      uint64_t pos() const { return d_pos; }
+      uint32_t batch_span() const { return d_batch_fft->batch()*d_num_samples; }
+      // Stream index of the oldest window still needed, by the search or a packet
+      uint64_t min_pos() const;
+      bool between_packets() const;
+
+      uint64_t late_allocations() const { return d_ws.late_allocations(); }
+      uint32_t tables_built() const { return d_tables.built(); }
+      uint64_t dropped_packets() const { return d_dropped_packets; }
+
+     private:
+      gr::block  *d_block;
+      pmt::pmt_t  d_out_port;
+      pmt::pmt_t  d_frames_port;
+
+      demod_state_t d_state;
+      uint8_t d_sf;
+      uint8_t d_cr;
+      uint8_t d_payload_len;
+      bool d_crc;
+      bool d_ldr;
+      bool d_header;
+
+      uint16_t d_num_symbols;
+      uint16_t d_fft_size_factor;
+      uint32_t d_fft_size;
+      uint16_t d_overlaps;
+      uint16_t d_offset;
+      uint16_t d_p;
+      uint32_t d_num_samples;
+      uint32_t d_bin_size;
+      uint32_t d_preamble_drift_max;
+
+      // The preamble search hops one symbol at a time, d_state only takes S_RESET..S_DETECT_PREAMBLE
+      uint64_t d_pos;                   // absolute stream index of its next symbol window
+      uint32_t d_preamble_idx;
+      uint16_t d_sfd_idx;
+      fixed_ring<uint32_t>  d_argmax_history;
+      std::vector<uint16_t> d_sfd_history;
+      bool     d_gated;                 // the last search window was skipped by the gate
+
+      // Packets in flight, each found preamble takes a free context
+      std::vector<demod_context> d_contexts;
+      std::vector<int>           d_due;
+      uint64_t                   d_dropped_packets;
+
+      uint16_t d_peak_search_algorithm;
+      uint16_t d_peak_search_phase_k;
+
+      // Tables of the current spreading factor, owned by d_tables
+      sf_cache<demod_sf_tables> d_tables;
+      batch_fft         *d_fft;
+      batch_fft         *d_batch_fft;
+      batch_fft         *d_ctx_fft;
+      const float       *d_window;
+      float              d_beta;
+
+      const gr_complex  *d_upchirp;
+      const gr_complex  *d_downchirp;
+
+      // Per window of the current search batch: its FFT slot, -1 while the gate is closed,
+      // and whether the gate reopened there
+      std::vector<int>     d_batch_slot;
+      std::vector<uint8_t> d_batch_replay;
+
+      // Runtime reconfiguration, applied between packets
+      phy_config  d_pending_config;
+      bool        d_reconfig;
+
+      // Decode each packet block by block while it is received
+      bool        d_decode_frames;
+      std::vector<uint8_t> d_frame;    // frames PDU payload, reserved for the longest frame
+
+      // Processing buffers, sized once in the constructor
+      workspace   d_ws;
+      gr_complex *d_up_block;
+      gr_complex *d_down_block;
+      float      *d_fft_res_mag;
+      float      *d_fft_res_add;
+      gr_complex *d_fft_res_add_c;
+      float      *d_phase_scratch;
+
+      // cos/sin of the FFT_PEAK_SEARCH_PHASE phase offsets
+      std::vector<float> d_phase_cos;
+      std::vector<float> d_phase_sin;
+
+      std::ofstream f_raw, f_up_windowless, f_up, f_down, f_fft;
+
+      uint32_t search_fft_peak(const lv_32fc_t *fft_result,
+                                   float *buffer1, float *buffer2,
+                                   gr_complex *buffer_c, float *max_val_p);
+      uint32_t fft_add(const lv_32fc_t *fft_result, float *buffer, gr_complex *buffer_c,
+                           float *max_val_p, float phase_offset);
+      void push_symbol(demod_context &ctx, float bin_idx);
+      void push_block(demod_context &ctx);
+      void dechirp_up(const gr_complex *in, gr_complex *fft_in);
+      void detect(const lv_32fc_t *up_fft);
+      void spawn_context(uint64_t pos);
+      uint32_t step(demod_context &ctx, const gr_complex *in0, const lv_32fc_t *up_fft);
+      void step_contexts(const gr_complex *in, uint64_t nread, uint64_t until);
+      void replay_preamble_history(const gr_complex *in0);
+      uint32_t calc_packet_symbol_len(const demod_context &ctx);
+      void select_sf(uint8_t sf);
+      void apply_config();
+
+      // Start of the lookback in front of the symbol window at stream index pos
+      const gr_complex *symbol_in0(const gr_complex *in, uint64_t nread, uint64_t pos) const
+      {
+        return &in[int64_t(pos - nread) - int64_t((DEMOD_HISTORY_DEPTH-1)*d_num_samples)];
+      }
+    };
+
+  } // namespace lora
+} // namespace gr
+
+#endif /* DEMOD_ENGINE_H */
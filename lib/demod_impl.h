@@ -21,70 +21,40 @@
 #ifndef INCLUDED_LORA_DEMOD_IMPL_H
 #define INCLUDED_LORA_DEMOD_IMPL_H
 
-#include <cmath>
-#include <cstdlib>
-#include <vector>
-#include <queue>
-#include <complex>
-#include <fstream>
-#include <gnuradio/fft/fft.h>
-#include <gnuradio/fft/window.h>
-#include <volk/volk.h>
 #include "lora/demod.h"
-#include "utilities.h"
+#include "demod_engine.h"
+#include "heap_counter.h"
+#include "squelch.h"
+#include "phy_config.h"
 
 namespace gr {
   namespace lora {
 
+    // Energy gate in front of the preamble search, one power_squelch update per search window
+    class squelch_gate : public search_gate
+    {
+     public:
+      power_squelch squelch;
+
+      bool enabled() const { return squelch.enabled(); }
+      bool open(const gr_complex *in, uint64_t nread, uint64_t pos, uint32_t n)
+      {
+        return squelch.update(&in[pos - nread], n);
+      }
+    };
+
     class demod_impl : public demod
     {
      private:
       pmt::pmt_t d_header_port;
       pmt::pmt_t d_out_port;
+      pmt::pmt_t d_frames_port;
+      pmt::pmt_t d_config_port;
 
-      demod_state_t d_state;
-      uint8_t d_sf;
-      uint8_t d_cr;
-      uint8_t d_payload_len;
-      bool d_crc;
-      bool d_ldr;
-      bool d_header;
-      bool d_header_received;
-      bool d_header_valid;
-
-      uint16_t d_num_symbols;
-      uint16_t d_fft_size_factor;
-      uint32_t d_fft_size;
-      uint16_t d_overlaps;
-      uint16_t d_offset;
-      uint16_t d_p;
-      uint32_t d_num_samples;
-      uint32_t d_bin_size;
-      uint32_t d_preamble_drift_max;
-
-      uint32_t d_packet_symbol_len;
-
-      float d_cfo;
-
-      uint32_t d_preamble_idx;
-      uint16_t d_sfd_idx;
-      std::vector<uint32_t> d_argmax_history;
-      std::vector<uint16_t> d_sfd_history;
-      uint16_t d_sync_recovery_counter;
-
-      uint16_t d_peak_search_algorithm;
-      uint16_t d_peak_search_phase_k;
-
-      fft::fft_complex   *d_fft;
-      std::vector<float> d_window;
-      float              d_beta;
-
-      std::vector<gr_complex> d_upchirp;
-      std::vector<gr_complex> d_downchirp;
-
-      std::vector<float> d_symbols;
-
-      std::ofstream f_raw, f_up_windowless, f_up, f_down, f_fft;
+      uint8_t       d_max_sf;
+      demod_engine *d_engine;
+      squelch_gate  d_gate;
+      heap_counter  d_heap;
 
      public:
       demod_impl( uint8_t   spreading_factor,
@@ -97,19 +67,14 @@ namespace gr {
                   uint16_t  fft_factor,
                   uint8_t   peak_search_algorithm,
                   uint16_t  peak_search_phase_k,
-                  float     fs_bw_ratio);
+                  float     fs_bw_ratio,
+                  uint8_t   max_sf);
       ~demod_impl();
 
-      uint16_t argmax(gr_complex *fft_result);
-      uint32_t argmax_32f(float *fft_result, float *max_val_p);
-      uint32_t search_fft_peak(const lv_32fc_t *fft_result,
-                                   float *buffer1, float *buffer2,
-                                   gr_complex *buffer_c, float *max_val_p);
-      uint32_t fft_add(const lv_32fc_t *fft_result, float *buffer, gr_complex *buffer_c,
-                           float *max_val_p, float phase_offset);
-      void dynamic_compensation(std::vector<uint16_t>& compensated_symbols);
-      
       void parse_header(pmt::pmt_t dict);
+      void set_config(pmt::pmt_t msg);
+      void set_squelch(float margin_db);
+      void set_decode_frames(bool enable);
 
       // Where all the action really happens
       void forecast (int noutput_items, gr_vector_int &ninput_items_required);
@@ -124,4 +89,3 @@ namespace gr {
 } // namespace gr
 
 #endif /* INCLUDED_LORA_DEMOD_IMPL_H */
-
@@ -0,0 +1,167 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unistd.h>
+#include <gnuradio/fft/fft.h>
+#include <gnuradio/fft/window.h>
+#include "dsp_registry.h"
+
+namespace gr {
+  namespace lora {
+
+    namespace {
+
+      typedef std::tuple<uint8_t, uint16_t, float>      chirp_key;
+      typedef std::tuple<uint32_t, uint16_t, int>       plan_key;
+
+      std::mutex                                                   s_chirp_mutex;
+      std::map<chirp_key, std::weak_ptr<const chirp_tables> >      s_chirps;
+
+      // Guarded by gr::fft::planner::mutex(), like all FFTW planning
+      std::map<plan_key, std::weak_ptr<const fft_plans> >          s_plans;
+      bool                                                         s_wisdom_loaded = false;
+
+      void
+      import_wisdom()
+      {
+        s_wisdom_loaded = true;
+        std::string filename = wisdom_filename();
+        if (!filename.empty())
+        {
+          // A missing file is the normal first run
+          fftwf_import_wisdom_from_filename(filename.c_str());
+        }
+      }
+
+      void
+      export_wisdom()
+      {
+        std::string filename = wisdom_filename();
+        if (filename.empty()) return;
+
+        // Other processes may read or write the file at the same time, replace it in one step
+        std::string tmp = filename + "." + std::to_string(getpid());
+        if (!fftwf_export_wisdom_to_filename(tmp.c_str()) || std::rename(tmp.c_str(), filename.c_str()) != 0)
+        {
+          std::remove(tmp.c_str());
+          std::cerr << "Unable to save FFTW wisdom to " << filename << std::endl;
+        }
+      }
+
+    }
+
+    std::string
+    wisdom_filename()
+    {
+      // Opt-in only, nothing is written to disk unless the user names the file
+      const char *path = std::getenv("LORA_FFTW_WISDOM");
+      return path != NULL ? path : "";
+    }
+
+    std::shared_ptr<const chirp_tables>
+    get_chirp_tables(uint8_t sf, uint16_t p, float beta)
+    {
+      std::lock_guard<std::mutex> lock(s_chirp_mutex);
+
+      std::weak_ptr<const chirp_tables> &slot = s_chirps[chirp_key(sf, p, beta)];
+      std::shared_ptr<const chirp_tables> tables = slot.lock();
+      if (tables) return tables;
+
+      const uint32_t num_samples = p*(1 << sf);
+      std::shared_ptr<chirp_tables> t = std::make_shared<chirp_tables>();
+      t->window = fft::window::build(fft::window::WIN_KAISER, num_samples, beta);
+      t->upchirp.reserve(num_samples);
+      t->downchirp.reserve(num_samples);
+      for (uint32_t i = 0; i < num_samples; i++) {
+        double phase = M_PI/p*(i-i*i/(float)num_samples);
+        t->downchirp.push_back(gr_complex(std::polar(1.0, phase)));
+        t->upchirp.push_back(gr_complex(std::polar(1.0, -phase)));
+      }
+
+      slot = t;
+      return t;
+    }
+
+    fft_plans::~fft_plans()
+    {
+      gr::fft::planner::scoped_lock lock(gr::fft::planner::mutex());
+      if (many) fftwf_destroy_plan(many);
+      if (one)  fftwf_destroy_plan(one);
+    }
+
+    std::shared_ptr<const fft_plans>
+    get_fft_plans(uint32_t num_samples, uint16_t fft_factor, int batch)
+    {
+      const uint32_t fft_size = fft_factor*num_samples;
+
+      gr::fft::planner::scoped_lock lock(gr::fft::planner::mutex());
+
+      std::weak_ptr<const fft_plans> &slot = s_plans[plan_key(num_samples, fft_factor, batch)];
+      std::shared_ptr<const fft_plans> plans = slot.lock();
+      if (plans) return plans;
+
+      if (!s_wisdom_loaded) import_wisdom();
+
+      // N-point transforms; rotation r of symbol i sits at (i*fft_factor + r)*N
+      // and lands on output bins i*fft_size + fft_factor*k + r
+      fftwf_iodim dim = { (int)num_samples, 1, fft_factor };
+      fftwf_iodim loops[2] = {
+        { batch,            (int)fft_size,        (int)fft_size },
+        { fft_factor,       (int)num_samples,     1 }
+      };
+
+      // FFTW_MEASURE scribbles over the arrays, plan on scratch of the same alignment as the batch_fft buffers
+      fftwf_complex *in  = (fftwf_complex *)fftwf_malloc((size_t)fft_size*batch*sizeof(gr_complex));
+      fftwf_complex *out = (fftwf_complex *)fftwf_malloc((size_t)fft_size*batch*sizeof(gr_complex));
+
+      std::shared_ptr<fft_plans> p = std::make_shared<fft_plans>();
+      if (in != NULL && out != NULL)
+      {
+        p->many = fftwf_plan_guru_dft(1, &dim, 2, loops, in, out, FFTW_FORWARD, FFTW_MEASURE);
+        p->one  = fftwf_plan_guru_dft(1, &dim, 1, &loops[1], in, out, FFTW_FORWARD, FFTW_MEASURE);
+      }
+      fftwf_free(in);
+      fftwf_free(out);
+      if (p->many == NULL || p->one == NULL)
+      {
+        std::cerr << "Unable to create FFT plan!" << std::endl;
+      }
+
+      export_wisdom();
+
+      slot = p;
+      return p;
+    }
+
+  }
+}
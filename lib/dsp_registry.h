@@ -0,0 +1,80 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef DSP_REGISTRY_H
+#define DSP_REGISTRY_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <gnuradio/types.h>
+#include <fftw3.h>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Chirp tables and Kaiser window of one (sf, fs_bw_ratio, beta), shared by all blocks.
+     */
+    struct chirp_tables
+    {
+      std::vector<gr_complex> upchirp;     // dechirps downchirps
+      std::vector<gr_complex> downchirp;   // dechirps upchirps
+      std::vector<float>      window;
+    };
+
+    /**
+     *  \brief  FFTW plans of the batch_fft layout for one (num_samples, fft_factor, batch).
+     *
+     *  Made on fftwf_malloc'ed scratch and only run through fftwf_execute_dft,
+     *  so every batch_fft of that layout can use them on its own buffers.
+     */
+    struct fft_plans
+    {
+      fft_plans() : many(NULL), one(NULL) {}
+      ~fft_plans();
+
+      fftwf_plan many;   // batch symbols, fft_factor rotations each
+      fftwf_plan one;    // one symbol, fft_factor rotations
+    };
+
+    /**
+     *  \brief  Process-wide cache of immutable DSP tables and FFT plans.
+     *
+     *  Entries are reference counted: the registry only keeps weak references,
+     *  so an entry is built by the first block asking for it and freed with the
+     *  last block holding it. If $LORA_FFTW_WISDOM names a file, FFTW wisdom is
+     *  loaded from it before the first plan is made and saved back whenever a
+     *  new plan was made, so a cold start plans from tuned wisdom instead of
+     *  measuring again.
+     *  All functions are thread safe.
+     */
+    std::shared_ptr<const chirp_tables> get_chirp_tables(uint8_t sf, uint16_t p, float beta);
+    std::shared_ptr<const fft_plans> get_fft_plans(uint32_t num_samples, uint16_t fft_factor, int batch);
+
+    /**
+     *  \brief  $LORA_FFTW_WISDOM, empty if it is not set (wisdom is not persisted).
+     */
+    std::string wisdom_filename();
+
+  }
+}
+
+#endif /* DSP_REGISTRY_H */
@@ -25,12 +25,6 @@
 #include <gnuradio/io_signature.h>
 #include "encode_impl.h"
 
-#define HAMMING_P1_BITMASK 0x0D  // 0b00001101
-#define HAMMING_P2_BITMASK 0x0B  // 0b00001011
-#define HAMMING_P3_BITMASK 0x07  // 0b00000111
-#define HAMMING_P4_BITMASK 0x0F  // 0b00001111
-#define HAMMING_P5_BITMASK 0x0E  // 0b00001110
-
 #define DEBUG_OUTPUT 0  // Controls debug print statements
 
 namespace gr
@@ -78,6 +72,10 @@ namespace gr
 
       set_msg_handler(d_in_port, boost::bind(&encode_impl::encode, this, _1));
 
+      d_config_port = pmt::mp("config");
+      message_port_register_in(d_config_port);
+      set_msg_handler(d_config_port, boost::bind(&encode_impl::set_config, this, _1));
+
       d_whitening_sequence = whitening_sequence;
 
       d_interleaver_size = d_sf;
@@ -92,6 +90,25 @@ namespace gr
     {
     }
 
+    void
+    encode_impl::set_config(pmt::pmt_t msg)
+    {
+      // Packets are encoded one message at a time, so a new config always starts on a packet boundary
+      phy_config cfg = { d_sf, d_cr, d_header, d_crc, d_ldr, 0 };
+      if (!update_phy_config(msg, cfg))
+      {
+        return;
+      }
+
+      d_sf                = cfg.sf;
+      d_cr                = cfg.cr;
+      d_header            = cfg.header;
+      d_crc               = cfg.crc;
+      d_ldr               = cfg.ldr;
+      d_interleaver_size  = d_sf;
+      d_fft_size          = (1 << d_sf);
+    }
+
     void
     encode_impl::gen_header(std::vector<unsigned char> &nibbles, uint8_t payload_len)
     {
@@ -203,66 +220,22 @@ namespace gr
     encode_impl::hamming_encode(std::vector<unsigned char> &nibbles,
                                 std::vector<unsigned char> &codewords)
     {
-      unsigned char p1, p2, p3, p4, p5;
-      unsigned char mask;
+      const fec_tables &fec = fec_tables::get();
 
       for (int i = 0; i < nibbles.size(); i++)
       {
-        p1 = parity((unsigned char)nibbles[i], mask = (unsigned char)HAMMING_P1_BITMASK);
-        p2 = parity((unsigned char)nibbles[i], mask = (unsigned char)HAMMING_P2_BITMASK);
-        p3 = parity((unsigned char)nibbles[i], mask = (unsigned char)HAMMING_P3_BITMASK);
-        p4 = parity((unsigned char)nibbles[i], mask = (unsigned char)HAMMING_P4_BITMASK);
-        p5 = parity((unsigned char)nibbles[i], mask = (unsigned char)HAMMING_P5_BITMASK);
-
         uint8_t cr_now = (i < d_sf - 2) ? 4 : d_cr;
 
-        switch (cr_now)
+        if (cr_now < 1 || cr_now > 4)
         {
-        case 1:
-          codewords.push_back((p4 << 4) |
-                              (nibbles[i] & 0xF));
-          break;
-        case 2:
-          codewords.push_back((p5 << 5) |
-                              (p3 << 4) |
-                              (nibbles[i] & 0xF));
-          break;
-        case 3:
-          codewords.push_back((p2 << 6) |
-                              (p5 << 5) |
-                              (p3 << 4) |
-                              (nibbles[i] & 0xF));
-          break;
-        case 4:
-          codewords.push_back((p1 << 7) |
-                              (p2 << 6) |
-                              (p5 << 5) |
-                              (p3 << 4) |
-                              (nibbles[i] & 0xF));
-          break;
-        default:
           // THIS CASE SHOULD NOT HAPPEN
           std::cerr << "Invalid Code Rate  -- this state should never occur." << std::endl;
-          break;
+          continue;
         }
+        codewords.push_back(fec.encode[cr_now - 1][nibbles[i] & 0xF]);
       }
     }
 
-    unsigned char
-    encode_impl::parity(unsigned char c, unsigned char bitmask)
-    {
-      unsigned char parity = 0;
-      unsigned char shiftme = c & bitmask;
-
-      for (int i = 0; i < 8; i++)
-      {
-        if (shiftme & 0x1) parity++;
-        shiftme = shiftme >> 1;
-      }
-
-      return parity % 2;
-    }
-
     void
     encode_impl::print_payload(std::vector<unsigned char> &payload)
     {
@@ -353,7 +326,9 @@ namespace gr
 #endif
 
       pmt::pmt_t output = pmt::init_u16vector(symbols.size(), symbols);
-      pmt::pmt_t msg_pair = pmt::cons(pmt::make_dict(), output);
+      // Pass the packet's metadata on, e.g. a tx_time for lora::mod
+      pmt::pmt_t meta = pmt::car(msg);
+      pmt::pmt_t msg_pair = pmt::cons(pmt::is_dict(meta) ? meta : pmt::make_dict(), output);
 
       message_port_pub(d_out_port, msg_pair);
     }
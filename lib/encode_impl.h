@@ -26,6 +26,8 @@
 #include <cmath>
 #include <lora/encode.h>
 #include "utilities.h"
+#include "phy_config.h"
+#include "fec.h"
 
 namespace gr {
   namespace lora {
@@ -37,6 +39,7 @@ namespace gr {
 
       pmt::pmt_t d_in_port;
       pmt::pmt_t d_out_port;
+      pmt::pmt_t d_config_port;
       
       unsigned char d_sf;
       unsigned char d_cr;
@@ -62,13 +65,13 @@ namespace gr {
       void whiten(std::vector<unsigned char> &bytes, uint8_t len);
       void interleave(std::vector<unsigned char> &codewords, std::vector<uint16_t> &symbols);
       void hamming_encode(std::vector<unsigned char> &nibbles, std::vector<unsigned char> &codewords);
-      unsigned char parity(unsigned char c, unsigned char bitmask);
       void print_payload(std::vector<unsigned char> &payload);
 
       void print_bitwise_u8 (std::vector<unsigned char>  &buffer);
       void print_bitwise_u16(std::vector<uint16_t> &buffer);
 
       void encode(pmt::pmt_t msg);
+      void set_config(pmt::pmt_t msg);
 
     };
 
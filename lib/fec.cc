@@ -0,0 +1,86 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "fec.h"
+
+// parity bits of a codeword, computed from the data nibble
+#define HAMMING_P1_BITMASK 0x0D  // 0b00001101
+#define HAMMING_P2_BITMASK 0x0B  // 0b00001011
+#define HAMMING_P3_BITMASK 0x07  // 0b00000111
+#define HAMMING_P4_BITMASK 0x0F  // 0b00001111
+#define HAMMING_P5_BITMASK 0x0E  // 0b00001110
+
+// not standard hamming code
+// LoRa codeword: p4 p2 p1 p3 d1 d2 d4 d3
+// pi: the ith parity; di: the ith data bits
+#define HAMMING_CHECK_P1_BITMASK 0x2E  // 0b00101110
+#define HAMMING_CHECK_P2_BITMASK 0x4B  // 0b01001011
+#define HAMMING_CHECK_P3_BITMASK 0x17  // 0b00010111
+
+namespace gr {
+  namespace lora {
+
+    const fec_tables &
+    fec_tables::get()
+    {
+      static const fec_tables tables;
+      return tables;
+    }
+
+    fec_tables::fec_tables()
+    {
+      for (int n = 0; n < 16; n++)
+      {
+        uint8_t p1 = __builtin_parity(n & HAMMING_P1_BITMASK);
+        uint8_t p2 = __builtin_parity(n & HAMMING_P2_BITMASK);
+        uint8_t p3 = __builtin_parity(n & HAMMING_P3_BITMASK);
+        uint8_t p4 = __builtin_parity(n & HAMMING_P4_BITMASK);
+        uint8_t p5 = __builtin_parity(n & HAMMING_P5_BITMASK);
+
+        encode[0][n] = (p4 << 4) | n;
+        encode[1][n] = (p5 << 5) | (p3 << 4) | n;
+        encode[2][n] = (p2 << 6) | (p5 << 5) | (p3 << 4) | n;
+        encode[3][n] = (p1 << 7) | (p2 << 6) | (p5 << 5) | (p3 << 4) | n;
+      }
+
+      for (int c = 0; c < 256; c++)
+      {
+        uint8_t codeword = c;
+        uint8_t p1 = __builtin_parity(codeword & HAMMING_CHECK_P1_BITMASK);
+        uint8_t p2 = __builtin_parity(codeword & HAMMING_CHECK_P2_BITMASK);
+        uint8_t p3 = __builtin_parity(codeword & HAMMING_CHECK_P3_BITMASK);
+        switch ((p3 << 2) | (p2 << 1) | p1)
+        {
+          case 3: codeword ^= 0x08; break;    // d1
+          case 5: codeword ^= 0x04; break;    // d2
+          case 6: codeword ^= 0x01; break;    // d3
+          case 7: codeword ^= 0x02; break;    // d4
+          default: break;                     // no error, parity error or more than one bit error
+        }
+
+        decode[0][c] = c & 0x0F;
+        decode[1][c] = c & 0x0F;
+        decode[2][c] = codeword & 0x0F;
+        decode[3][c] = codeword & 0x0F;
+      }
+    }
+
+  }
+}
@@ -0,0 +1,53 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef FEC_H
+#define FEC_H
+
+#include <cstdint>
+#include <lora/api.h>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Lookup tables of the LoRa Hamming codes, CR 4/5 to 4/8.
+     *
+     *  encode[cr-1][nibble] is the 4+cr bit codeword of a data nibble,
+     *  decode[cr-1][codeword] its data nibble. CR 4/7 and 4/8 correct a
+     *  single bit error in the data bits, 4/5 and 4/6 only strip the parity.
+     *  The tables are built once per process and shared by lora::encode and
+     *  lora::decode, so FEC is one load per nibble. Exported for the C++ qa tests.
+     */
+    struct LORA_API fec_tables
+    {
+      uint8_t encode[4][16];
+      uint8_t decode[4][256];
+
+      static const fec_tables &get();
+
+     private:
+      fec_tables();
+    };
+
+  }
+}
+
+#endif /* FEC_H */
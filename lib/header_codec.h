@@ -0,0 +1,60 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef HEADER_CODEC_H
+#define HEADER_CODEC_H
+
+#include <cstdint>
+#include "utilities.h"
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Fields of an explicit LoRa header.
+     */
+    struct lora_header
+    {
+      uint8_t payload_len;
+      uint8_t cr;
+      bool    crc;
+      bool    valid;            // checksum matches and cr is 1..4
+    };
+
+    /**
+     *  \brief  Parse the first five nibbles of the header block and check its checksum.
+     */
+    inline lora_header parse_header_nibbles(const uint8_t *nibbles)
+    {
+      lora_header header;
+      header.payload_len  = (nibbles[0] << 4) | nibbles[1];
+      header.crc          = nibbles[2] & 1;
+      header.cr           = nibbles[2] >> 1;
+
+      uint8_t checksum    = (nibbles[3] << 4) | nibbles[4];
+      header.valid        = checksum == gr::lora::header_checksum(header.payload_len, nibbles[2] & 0xF)
+                            && header.cr > 0 && header.cr < 5;
+      return header;
+    }
+
+  }
+}
+
+#endif /* HEADER_CODEC_H */
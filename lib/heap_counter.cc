@@ -0,0 +1,84 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "heap_counter.h"
+
+#ifdef LORA_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+// Linked with heap_counter.map and -Bsymbolic-functions, so only calls made
+// from this library resolve here; the rest of the process keeps the default
+// allocator.
+static thread_local uint64_t s_heap_allocations = 0;
+
+void *operator new(std::size_t size)
+{
+  s_heap_allocations++;
+  void *p = std::malloc(size ? size : 1);
+  if (p == NULL) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](std::size_t size)
+{
+  return ::operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+  std::free(p);
+}
+#endif
+
+namespace gr {
+  namespace lora {
+
+    uint64_t
+    thread_heap_allocations()
+    {
+      #ifdef LORA_COUNT_ALLOCATIONS
+        return s_heap_allocations;
+      #else
+        return 0;
+      #endif
+    }
+
+    bool
+    heap_counter::enabled()
+    {
+      #ifdef LORA_COUNT_ALLOCATIONS
+        return true;
+      #else
+        return false;
+      #endif
+    }
+
+  }
+}
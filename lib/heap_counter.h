@@ -0,0 +1,74 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef HEAP_COUNTER_H
+#define HEAP_COUNTER_H
+
+#include <cstdint>
+
+namespace gr {
+  namespace lora {
+
+    /*!
+     * Number of operator new calls made by this library on the calling thread.
+     * Always 0 unless the library was configured with ENABLE_ALLOCATION_COUNTER.
+     */
+    uint64_t thread_heap_allocations();
+
+    /**
+     *  \brief  Heap allocations made inside one block's work functions.
+     *
+     *  With ENABLE_ALLOCATION_COUNTER the library defines its own operator
+     *  new, kept private to the library by a linker version script, which
+     *  counts allocations per thread. A scope placed at the top of
+     *  general_work() adds the allocations made until it returns.
+     *  Allocations made inside other libraries (the pmt objects built when a
+     *  message is published, the scheduler's own buffers) are not seen.
+     */
+    class heap_counter
+    {
+     public:
+      heap_counter() : d_count(0) {}
+
+      static bool enabled();
+
+      uint64_t count() const { return d_count; }
+
+      class scope
+      {
+       public:
+        scope(heap_counter &counter)
+          : d_counter(counter), d_start(thread_heap_allocations()) {}
+
+        ~scope() { d_counter.d_count += thread_heap_allocations() - d_start; }
+
+       private:
+        heap_counter &d_counter;
+        uint64_t      d_start;
+      };
+
+     private:
+      uint64_t d_count;
+    };
+
+  }
+}
+
+#endif /* HEAP_COUNTER_H */
@@ -27,47 +27,64 @@
 
 #define DUMP_IQ 0 // Enables debug output
 
+// Item layout of a packet, see item_at()
+#define MOD_ITEM_PREAMBLE   1
+#define MOD_ITEM_SYNC       (MOD_ITEM_PREAMBLE + NUM_PREAMBLE_CHIRPS)
+#define MOD_ITEM_SFD        (MOD_ITEM_SYNC + 2)
+#define MOD_ITEM_PAYLOAD    (MOD_ITEM_SFD + 3)
+
 namespace gr {
   namespace lora {
 
     mod::sptr
-    mod::make(  short spreading_factor, unsigned char sync_word)
+    mod::make(  short spreading_factor, unsigned char sync_word, float fs_bw_ratio, uint8_t output_mode)
     {
       return gnuradio::get_initial_sptr
-        (new mod_impl(spreading_factor, sync_word));
+        (new mod_impl(spreading_factor, sync_word, fs_bw_ratio, output_mode));
     }
 
     /*
      * The private constructor
      */
     mod_impl::mod_impl( short spreading_factor,
-                        unsigned char sync_word)
+                        unsigned char sync_word,
+                        float fs_bw_ratio,
+                        uint8_t output_mode)
       : gr::block("mod",
               gr::io_signature::make(0, 0, 0),
               gr::io_signature::make(1, 1, sizeof(gr_complex))),
         f_mod("mod.out", std::ios::out),
         d_sf(spreading_factor),
-        d_sync_word(sync_word)
+        d_sync_word(sync_word),
+        d_burst(output_mode == MOD_OUTPUT_BURST),
+        d_item(0),
+        d_item_pos(0),
+        d_dropped_packets(0)
     {
       assert((d_sf > 5) && (d_sf < 13));
+      assert(((int)fs_bw_ratio) == fs_bw_ratio && fs_bw_ratio >= 1);
+      d_os = (int) fs_bw_ratio;
+
+      d_sob_key  = pmt::intern("tx_sob");
+      d_eob_key  = pmt::intern("tx_eob");
+      d_time_key = pmt::intern("tx_time");
 
       d_in_port = pmt::mp("in");
       message_port_register_in(d_in_port);
       set_msg_handler(d_in_port, boost::bind(&mod_impl::modulate, this, _1));
 
-      d_fft_size = (1 << d_sf);
+      d_config_port = pmt::mp("config");
+      message_port_register_in(d_config_port);
+      set_msg_handler(d_config_port, boost::bind(&mod_impl::set_config, this, _1));
 
-      float phase = -M_PI;
-      double accumulator = 0;
+      select_sf(d_sf);
 
-      for (int i = 0; i < 2*d_fft_size; i++)
+      // The longest packets are those of the lowest spreading factor
+      d_pending.reset(MOD_QUEUE_PACKETS);
+      for (size_t i = 0; i < d_pending.capacity(); i++)
       {
-        accumulator += phase;
-        d_downchirp.push_back(gr_complex(std::conj(std::polar(1.0, accumulator))));
-        d_upchirp.push_back(gr_complex(std::polar(1.0, accumulator)));
-        phase += (2*M_PI)/d_fft_size;
+        d_pending.slot(i).symbols.reserve(gr::lora::max_packet_symbol_len(7, true));
       }
-
     }
 
     /*
@@ -77,6 +94,28 @@ namespace gr {
     {
     }
 
+    void
+    mod_impl::select_sf(uint8_t sf)
+    {
+      d_sf       = sf;
+      d_fft_size = (1 << d_sf);
+      d_synth    = &d_tables.get(d_sf, [this](uint8_t sf) { return new chirp_synth(sf, d_os); });
+    }
+
+    void
+    mod_impl::set_config(pmt::pmt_t msg)
+    {
+      // Only "sf" applies to the modulator. Queued packets keep the spreading factor
+      // they were queued under, so the switch is on a packet boundary.
+      phy_config cfg = { d_sf, 1, false, false, false, 0 };
+      if (!update_phy_config(msg, cfg))
+      {
+        return;
+      }
+
+      select_sf(cfg.sf);
+    }
+
     void
     mod_impl::modulate (pmt::pmt_t msg)
     {
@@ -85,57 +124,74 @@ namespace gr {
       size_t pkt_len(0);
       const uint16_t* symbols_in = pmt::u16vector_elements(symbols, pkt_len);
 
-      std::vector<gr_complex> iq_out;
-
-      // Preamble
-      for (int i = 0; i < NUM_PREAMBLE_CHIRPS*d_fft_size; i++)
+      if (d_pending.full())
       {
-        iq_out.push_back(d_upchirp[(i) % d_fft_size]);
+        if (d_dropped_packets++ == 0)
+        {
+          std::cerr << "Modulator queue full (" << d_pending.capacity() << " packets), dropping packets." << std::endl;
+        }
+        return;
       }
 
-      // Sync Word 0
-      for (int i = 0; i < d_fft_size; i++)
+      mod_packet &pkt = d_pending.back();
+      pkt.synth = d_synth;
+      pkt.symbols.assign(symbols_in, symbols_in + pkt_len);
+      pkt.has_time = pmt::is_dict(pmt::car(msg)) && pmt::dict_has_key(pmt::car(msg), d_time_key);
+      if (pkt.has_time)
       {
-        iq_out.push_back(d_upchirp[(8*((d_sync_word & 0xF0) >> 4) + i) % d_fft_size]);
+        pkt.tx_time = pmt::dict_ref(pmt::car(msg), d_time_key, pmt::PMT_NIL);
       }
+      d_pending.push();
+    }
+
+    uint32_t
+    mod_impl::num_items(const mod_packet &pkt)
+    {
+      return MOD_ITEM_PAYLOAD + pkt.symbols.size() + 1;
+    }
+
+    mod_item
+    mod_impl::item_at(const mod_packet &pkt, uint32_t i)
+    {
+      const uint32_t len = pkt.synth->symbol_len();
+      const uint16_t os  = len / pkt.synth->num_symbols();
+      mod_item it = { MI_ZERO, 0, len };
 
-      // Sync Word 1
-      for (int i = 0; i < d_fft_size; i++)
+      if (i < MOD_ITEM_PREAMBLE)
       {
-        iq_out.push_back(d_upchirp[(8*(d_sync_word & 0x0F) + i) % d_fft_size]);
+        // Leading zero-magnitude samples, none in burst mode
+        it.len = d_burst ? 0 : 4*len;
       }
-
-      // SFD Downchirps
-      for (int i = 0; i < (2*d_fft_size+d_fft_size/4); i++)
+      else if (i < MOD_ITEM_SYNC)
       {
-        iq_out.push_back(d_downchirp[(i) % d_fft_size]);
+        // Preamble
+        it.kind = MI_UP;
       }
-
-      // Payload
-      for (int i = 0; i < pkt_len; i++)
+      else if (i < MOD_ITEM_SFD)
       {
-        for (int j = 0; j < d_fft_size; j++)
-        {
-          iq_out.push_back(d_upchirp[(symbols_in[i] + j) % d_fft_size]); // MAGIC -- adjusting for the SFD quarter chirp
-        }
+        // Sync Word 0 and 1
+        it.kind   = MI_UP;
+        it.symbol = (i == MOD_ITEM_SYNC) ? 8*((d_sync_word & 0xF0) >> 4) : 8*(d_sync_word & 0x0F);
       }
-
-      // Prepend zero-magnitude samples
-      d_iq_out.insert(d_iq_out.begin(), 4*d_fft_size, gr_complex(std::polar(0.0, 0.0)));
-
-      // Append samples to IQ output buffer
-      for (int i = 0; i < iq_out.size(); i++)
+      else if (i < MOD_ITEM_PAYLOAD)
       {
-        d_iq_out.push_back(iq_out[i]);  // Writing to buffer separately for now to expose local packet for debugging
+        // SFD Downchirps, 2.25 chirps
+        it.kind = MI_DOWN;
+        if (i == MOD_ITEM_PAYLOAD - 1) it.len = len/4;
+      }
+      else if (i < MOD_ITEM_PAYLOAD + pkt.symbols.size())
+      {
+        // Payload
+        it.kind   = MI_UP;
+        it.symbol = pkt.symbols[i - MOD_ITEM_PAYLOAD];
+      }
+      else
+      {
+        // Trailing zero-magnitude samples to kick squelch in simulation, none in burst mode
+        it.len = d_burst ? 0 : 4*len + 128*os;
       }
-      
-      // Append zero-magnitude samples to kick squelch in simulation
-      d_iq_out.insert(d_iq_out.end(), 4*d_fft_size+128, gr_complex(std::polar(0.0, 0.0)));
 
-      // Uncomment to write out modulated payload to disk
-      #if DUMP_IQ
-        f_mod.write((const char *)&d_iq_out[0], d_iq_out.size()*sizeof(gr_complex));
-      #endif
+      return it;
     }
 
     int
@@ -145,14 +201,63 @@ namespace gr {
                        gr_vector_void_star &output_items)
     {
       gr_complex *out = (gr_complex *) output_items[0];
-      uint32_t noutput_samples = (noutput_items > d_iq_out.size()) ? d_iq_out.size() : noutput_items;
+      uint32_t noutput_samples = 0;
 
-      if (noutput_samples)
+      // Whole symbols are memcpy'd from the chirp tables, the output buffer is the only sample storage
+      while (noutput_samples < noutput_items && !d_pending.empty())
       {
-        memcpy(out, &d_iq_out[0], noutput_samples*sizeof(gr_complex));
-        d_iq_out.erase(d_iq_out.begin(), d_iq_out.begin()+noutput_samples);
+        const mod_packet &pkt = d_pending.front();
+        mod_item it = item_at(pkt, d_item);
+        uint32_t n  = std::min(it.len - d_item_pos, noutput_items - noutput_samples);
+
+        // A burst runs from the first preamble sample to the last sample before the trailing zeros
+        if (d_burst && n > 0)
+        {
+          if (d_item == MOD_ITEM_PREAMBLE && d_item_pos == 0)
+          {
+            add_item_tag(0, nitems_written(0) + noutput_samples, d_sob_key, pmt::PMT_T);
+            if (pkt.has_time)
+            {
+              add_item_tag(0, nitems_written(0) + noutput_samples, d_time_key, pkt.tx_time);
+            }
+          }
+          if (d_item == num_items(pkt) - 2 && d_item_pos + n == it.len)
+          {
+            add_item_tag(0, nitems_written(0) + noutput_samples + n - 1, d_eob_key, pmt::PMT_T);
+          }
+        }
+
+        switch (it.kind)
+        {
+        case MI_UP:
+          pkt.synth->upchirp(&out[noutput_samples], it.symbol, d_item_pos, n);
+          break;
+        case MI_DOWN:
+          pkt.synth->downchirp(&out[noutput_samples], d_item_pos, n);
+          break;
+        default:
+          memset((void *)&out[noutput_samples], 0, n*sizeof(gr_complex));
+          break;
+        }
+
+        noutput_samples += n;
+        d_item_pos      += n;
+        if (d_item_pos == it.len)
+        {
+          d_item_pos = 0;
+          if (++d_item == num_items(pkt))
+          {
+            d_item = 0;
+            d_pending.pop();
+          }
+        }
       }
 
+      // Uncomment to write out modulated samples to disk
+      #if DUMP_IQ
+        f_mod.write((const char *)out, noutput_samples*sizeof(gr_complex));
+      #endif
+
       return noutput_samples;
     }
 
@@ -26,36 +26,82 @@
 #include <fstream>
 #include <volk/volk.h>
 #include <lora/mod.h>
+#include "sf_cache.h"
+#include "phy_config.h"
+#include "chirp_synth.h"
+#include "spsc_queue.h"
+#include "utilities.h"
 
 #define NUM_PREAMBLE_CHIRPS   8
 #define LORA_SYNCWORD0        3
 #define LORA_SYNCWORD1        4
 
+#define MOD_QUEUE_PACKETS     64    // packets waiting to be modulated, further ones are dropped
+
 namespace gr {
   namespace lora {
 
+    // A packet waiting in the queue, modulated with the spreading factor it was queued under
+    struct mod_packet
+    {
+      const chirp_synth     *synth;
+      std::vector<uint16_t>  symbols;
+      bool                   has_time;
+      pmt::pmt_t             tx_time;
+    };
+
+    // A run of samples of a packet: zeros, an upchirp of a symbol, or the downchirp
+    enum mod_item_kind_t {
+      MI_ZERO,
+      MI_UP,
+      MI_DOWN
+    };
+
+    struct mod_item
+    {
+      mod_item_kind_t kind;
+      uint32_t        symbol;
+      uint32_t        len;
+    };
+
     class mod_impl : public mod
     {
      private:
       pmt::pmt_t d_in_port;
+      pmt::pmt_t d_config_port;
 
       unsigned char d_sf;
       unsigned char d_sync_word;
 
       uint16_t d_fft_size;
       unsigned char  d_interleaver_size;
-
-      std::vector<gr_complex> d_upchirp;
-      std::vector<gr_complex> d_downchirp;
-
-      std::vector<gr_complex> d_iq_out;
+      uint16_t d_os;
+      bool     d_burst;
+      pmt::pmt_t d_sob_key;
+      pmt::pmt_t d_eob_key;
+      pmt::pmt_t d_time_key;
+
+      // Synthesis tables of every spreading factor used, d_synth is the current one
+      sf_cache<chirp_synth> d_tables;
+      const chirp_synth    *d_synth;
+
+      // Packets are turned into samples only as the scheduler asks for them,
+      // d_item/d_item_pos is the position within the packet at the front
+      spsc_queue<mod_packet> d_pending;
+      uint32_t d_item;
+      uint32_t d_item_pos;
+      uint64_t d_dropped_packets;
 
       std::ofstream f_mod;
 
      public:
-      mod_impl( short spreading_factor, unsigned char d_sync_word);
+      mod_impl( short spreading_factor, unsigned char d_sync_word, float fs_bw_ratio, uint8_t output_mode);
       ~mod_impl();
 
+      uint32_t num_items(const mod_packet &pkt);
+      mod_item item_at(const mod_packet &pkt, uint32_t i);
+      void select_sf(uint8_t sf);
+      void set_config(pmt::pmt_t msg);
       void modulate (pmt::pmt_t msg);
 
       int general_work(int noutput_items,
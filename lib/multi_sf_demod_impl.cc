@@ -0,0 +1,280 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gnuradio/io_signature.h>
+#include "multi_sf_demod_impl.h"
+
+#define DEBUG_OFF     0
+#define DEBUG_INFO    1
+#define DEBUG_VERBOSE 2
+#define DEBUG         DEBUG_OFF
+
+// The window is not used here, lora::demod's default beta shares its chirp tables
+#define MULTI_SF_WINDOW_BETA 25.0f
+
+// Idle spreading factors only cost an FFT per symbol while the input is above the noise floor
+#define MULTI_SF_SQUELCH_DEFAULT 1.0f  // dB
+
+namespace gr {
+  namespace lora {
+
+    multi_sf_demod::sptr
+    multi_sf_demod::make( uint8_t   min_sf,
+                          uint8_t   max_sf,
+                          bool      header,
+                          uint8_t   payload_len,
+                          uint8_t   cr,
+                          bool      crc,
+                          bool      low_data_rate,
+                          uint16_t  fft_factor,
+                          uint8_t   peak_search_algorithm,
+                          uint16_t  peak_search_phase_k,
+                          float     fs_bw_ratio)
+    {
+      return gnuradio::get_initial_sptr
+        (new multi_sf_demod_impl(min_sf, max_sf, header, payload_len, cr, crc, low_data_rate, fft_factor, peak_search_algorithm, peak_search_phase_k, fs_bw_ratio));
+    }
+
+    /*
+     * The private constructor
+     */
+    multi_sf_demod_impl::multi_sf_demod_impl( uint8_t   min_sf,
+                                              uint8_t   max_sf,
+                                              bool      header,
+                                              uint8_t   payload_len,
+                                              uint8_t   cr,
+                                              bool      crc,
+                                              bool      low_data_rate,
+                                              uint16_t  fft_factor,
+                                              uint8_t   peak_search_algorithm,
+                                              uint16_t  peak_search_phase_k,
+                                              float     fs_bw_ratio)
+      : gr::block("multi_sf_demod",
+              gr::io_signature::make(1, 1, sizeof(gr_complex)),
+              gr::io_signature::make(0, 0, 0))
+    {
+      assert((min_sf > 5) && (max_sf < 13) && (min_sf <= max_sf));
+      assert((cr > 0) && (cr < 5));
+      if (min_sf == 6) assert(!header);
+      assert(fft_factor > 0);
+      assert(((int)fs_bw_ratio) == fs_bw_ratio);
+      uint16_t p = (int) fs_bw_ratio;
+
+      d_header_port = pmt::mp("header");
+      message_port_register_in(d_header_port);
+      d_out_port = pmt::mp("out");
+      message_port_register_out(d_out_port);
+      d_frames_port = pmt::mp("frames");
+      message_port_register_out(d_frames_port);
+
+      set_msg_handler(d_header_port, boost::bind(&multi_sf_demod_impl::parse_header, this, _1));
+
+      d_config_port = pmt::mp("config");
+      message_port_register_in(d_config_port);
+      set_msg_handler(d_config_port, boost::bind(&multi_sf_demod_impl::set_config, this, _1));
+
+      uint32_t span = 0;
+      for (uint8_t sf = min_sf; sf <= max_sf; sf++)
+      {
+        phy_config cfg;
+        cfg.sf          = sf;
+        cfg.cr          = cr;
+        cfg.header      = header;
+        cfg.crc         = crc;
+        cfg.ldr         = low_data_rate && (sf > 10);
+        cfg.payload_len = payload_len;
+        d_engines.push_back(new demod_engine(this, d_out_port, d_frames_port, cfg, sf, p, fft_factor,
+                                             MULTI_SF_WINDOW_BETA, peak_search_algorithm, peak_search_phase_k));
+        span = std::max(span, d_engines.back()->batch_span());
+      }
+      const uint32_t max_num_samples = d_engines.back()->num_samples();
+
+      // The engine stepped next is the one whose next symbol ends first, so the others ask
+      // for windows at most a symbol of the largest spreading factor before it, and it
+      // looks ahead by at most one batch
+      d_gate.reset(d_engines.front()->num_samples(), span + 2*max_num_samples);
+      d_gate.squelch.set_margin(MULTI_SF_SQUELCH_DEFAULT);
+
+      // One input window serves every engine; it has to cover the lookback of the slowest one
+      set_history(DEMOD_HISTORY_DEPTH*max_num_samples);
+    }
+
+    /*
+     * Our virtual destructor.
+     */
+    multi_sf_demod_impl::~multi_sf_demod_impl()
+    {
+      #if DEBUG >= DEBUG_INFO
+        if (heap_counter::enabled()) std::cout << "heap allocations in general_work: " << d_heap.count() << std::endl;
+        std::cout << "gate blocks skipped by the squelch: " << d_gate.squelch.gated() << std::endl;
+      #endif
+      for (auto engine : d_engines)
+      {
+        delete engine;
+      }
+    }
+
+    void
+    multi_sf_gate::reset(uint32_t block_len, uint32_t span)
+    {
+      d_block_len = block_len;
+      d_pos       = 0;
+      d_open.reset(span / block_len + 2);
+    }
+
+    bool
+    multi_sf_gate::open(const gr_complex *in, uint64_t nread, uint64_t pos, uint32_t n)
+    {
+      // Blocks older than the ring or the input are gone (or the squelch was just enabled), restart at pos
+      if (d_pos < nread || d_pos + d_open.capacity()*d_block_len < pos)
+      {
+        d_pos = pos;
+        d_open.clear();
+      }
+
+      while (d_pos + d_block_len <= pos + n)
+      {
+        d_open.push_back(squelch.update(&in[d_pos - nread], d_block_len));
+        d_pos += d_block_len;
+      }
+
+      // Block i from the newest ends at d_pos - i*d_block_len
+      for (size_t i = 0; i < d_open.size() && d_pos - i*d_block_len > pos; i++)
+      {
+        if (d_open.recent(i))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void
+    multi_sf_demod_impl::parse_header(pmt::pmt_t dict)
+    {
+      // Explicit headers are decoded in S_READ_HEADER and no header requests are
+      // sent any more, the port only stays so that existing flowgraphs still connect
+    }
+
+    void
+    multi_sf_demod_impl::set_config(pmt::pmt_t msg)
+    {
+      if (pmt::is_dict(msg) && pmt::dict_has_key(msg, pmt::intern("sf")))
+      {
+        std::cerr << "The spreading factors of multi_sf_demod are fixed, \"sf\" ignored." << std::endl;
+        msg = pmt::dict_delete(msg, pmt::intern("sf"));
+      }
+
+      // Every engine takes the change, or none if it is invalid for one of them
+      std::vector<phy_config> cfgs;
+      for (auto engine : d_engines)
+      {
+        phy_config cfg = engine->config();
+        if (!update_phy_config(msg, cfg))
+        {
+          return;
+        }
+        cfg.ldr = cfg.ldr && (cfg.sf > 10);
+        cfgs.push_back(cfg);
+      }
+      for (size_t i = 0; i < d_engines.size(); i++)
+      {
+        d_engines[i]->configure(cfgs[i]);
+      }
+    }
+
+    void
+    multi_sf_demod_impl::set_squelch(float margin_db)
+    {
+      d_gate.squelch.set_margin(margin_db);
+    }
+
+    void
+    multi_sf_demod_impl::set_decode_frames(bool enable)
+    {
+      for (auto engine : d_engines)
+      {
+        engine->set_decode_frames(enable);
+      }
+    }
+
+    void
+    multi_sf_demod_impl::forecast (int noutput_items,
+                                   gr_vector_int &ninput_items_required)
+    {
+      // Enough input for the engine that is furthest from completing its next symbol
+      uint64_t nread = nitems_read(0);
+      uint64_t need  = 0;
+      for (auto engine : d_engines)
+      {
+        need = std::max(need, engine->pos() + engine->num_samples() - nread);
+      }
+      ninput_items_required[0] = need + history() - 1;
+    }
+
+    int
+    multi_sf_demod_impl::general_work (int noutput_items,
+                       gr_vector_int &ninput_items,
+                       gr_vector_const_void_star &input_items,
+                       gr_vector_void_star &output_items)
+    {
+      heap_counter::scope heap_scope(d_heap);
+      // input_items[0][history()-1] is the sample at nitems_read()
+      const gr_complex *in = (const gr_complex *) input_items[0] + (history() - 1);
+      const uint64_t nread = nitems_read(0);
+      // ninput_items counts the history() - 1 samples before nitems_read() as well
+      const uint64_t end   = nread + ninput_items[0] - (history() - 1);
+
+      while (true)
+      {
+        // Step the engine whose next symbol ends first, so the engines move through the stream together
+        demod_engine *next = NULL;
+        for (auto engine : d_engines)
+        {
+          if (engine->pos() + engine->num_samples() <= end &&
+              (!next || engine->pos() + engine->num_samples() < next->pos() + next->num_samples()))
+          {
+            next = engine;
+          }
+        }
+        if (!next)
+        {
+          break;
+        }
+        next->work(in, nread, end, d_gate);
+      }
+
+      // Keep the window of the slowest engine, history() covers every engine's lookback
+      uint64_t min_pos = std::numeric_limits<uint64_t>::max();
+      for (auto engine : d_engines)
+      {
+        min_pos = std::min(min_pos, engine->min_pos());
+      }
+      consume_each(min_pos - nread);
+
+      return noutput_items;
+    }
+
+  } /* namespace lora */
+} /* namespace gr */
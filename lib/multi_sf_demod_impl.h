@@ -0,0 +1,100 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef INCLUDED_LORA_MULTI_SF_DEMOD_IMPL_H
+#define INCLUDED_LORA_MULTI_SF_DEMOD_IMPL_H
+
+#include <vector>
+#include <limits>
+#include <lora/demod.h>
+#include <lora/multi_sf_demod.h>
+#include "demod_engine.h"
+#include "heap_counter.h"
+#include "ring_buffer.h"
+#include "squelch.h"
+#include "phy_config.h"
+
+namespace gr {
+  namespace lora {
+
+    // Energy gate shared by the engines of every spreading factor, evaluated once per block of
+    // the smallest symbol length; a search window is open if any block it overlaps is open
+    class multi_sf_gate : public search_gate
+    {
+     public:
+      power_squelch squelch;
+
+      // span: how far apart in the stream the engines may ask for windows
+      void reset(uint32_t block_len, uint32_t span);
+
+      bool enabled() const { return squelch.enabled(); }
+      bool open(const gr_complex *in, uint64_t nread, uint64_t pos, uint32_t n);
+
+     private:
+      uint32_t              d_block_len;
+      uint64_t              d_pos;      // absolute stream index where the next block starts
+      fixed_ring<uint8_t>   d_open;     // open flags of the most recent blocks
+    };
+
+    class multi_sf_demod_impl : public multi_sf_demod
+    {
+     private:
+      pmt::pmt_t d_header_port;
+      pmt::pmt_t d_out_port;
+      pmt::pmt_t d_frames_port;
+      pmt::pmt_t d_config_port;
+
+      // One lora::demod receiver per spreading factor, from min_sf up
+      std::vector<demod_engine *> d_engines;
+      multi_sf_gate               d_gate;
+      heap_counter                d_heap;
+
+     public:
+      multi_sf_demod_impl(uint8_t   min_sf,
+                          uint8_t   max_sf,
+                          bool      header,
+                          uint8_t   payload_len,
+                          uint8_t   cr,
+                          bool      crc,
+                          bool      low_data_rate,
+                          uint16_t  fft_factor,
+                          uint8_t   peak_search_algorithm,
+                          uint16_t  peak_search_phase_k,
+                          float     fs_bw_ratio);
+      ~multi_sf_demod_impl();
+
+      void parse_header(pmt::pmt_t dict);
+      void set_config(pmt::pmt_t msg);
+      void set_squelch(float margin_db);
+      void set_decode_frames(bool enable);
+
+      // Where all the action really happens
+      void forecast (int noutput_items, gr_vector_int &ninput_items_required);
+
+      int general_work(int noutput_items,
+           gr_vector_int &ninput_items,
+           gr_vector_const_void_star &input_items,
+           gr_vector_void_star &output_items);
+    };
+
+  } // namespace lora
+} // namespace gr
+
+#endif /* INCLUDED_LORA_MULTI_SF_DEMOD_IMPL_H */
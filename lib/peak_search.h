@@ -0,0 +1,262 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef PEAK_SEARCH_H
+#define PEAK_SEARCH_H
+
+#include <algorithm>
+#include <cmath>
+#include <volk/volk.h>
+#include <gnuradio/types.h>
+
+namespace gr {
+  namespace lora {
+
+    /*
+     * Peak search over FFT magnitudes. The scans go through volk, which
+     * picks the SSE/AVX/AVX-512 (or NEON) kernel for the running CPU.
+     */
+
+    /**
+     *  \brief  Index of the largest value (first one on ties)
+     *
+     *  \param  res
+     *          non-negative values, e.g. FFT magnitudes
+     *  \param  p_max_val
+     *          receives res[index]
+     *  \param  len
+     *          number of values
+     */
+    inline uint32_t argmax_32f(const float *res, float *p_max_val, uint32_t len)
+    {
+      uint32_t max_idx = 0;
+      volk_32f_index_max_32u(&max_idx, res, len);
+      *p_max_val = res[max_idx];
+      return max_idx;
+    }
+
+    /**
+     *  \brief  Index of the strongest bin of a complex spectrum and its magnitude
+     *
+     *  Only the ordering matters for the search, so it runs on squared
+     *  magnitudes and takes a single square root at the peak.
+     *
+     *  \param  fft_result
+     *          complex spectrum
+     *  \param  buffer
+     *          scratch space of len floats, holds the squared magnitudes on return
+     *  \param  p_max_val
+     *          receives the magnitude of the peak
+     *  \param  len
+     *          number of bins
+     */
+    inline uint32_t argmax_mag_32fc(const gr_complex *fft_result, float *buffer, float *p_max_val, uint32_t len)
+    {
+      volk_32fc_magnitude_squared_32f(buffer, fft_result, len);
+      uint32_t max_idx = argmax_32f(buffer, p_max_val, len);
+      *p_max_val = std::sqrt(*p_max_val);
+      return max_idx;
+    }
+
+    // Bins per block of argmax_phase_sum_32fc, small enough for the block to stay in L1
+    const uint32_t PHASE_SEARCH_BLOCK = 256;
+
+    /**
+     *  \brief  Scratch floats argmax_phase_sum_32fc needs for k phases
+     */
+    inline uint32_t phase_search_scratch_len(uint16_t k)
+    {
+      return 4*PHASE_SEARCH_BLOCK + 2*k;
+    }
+
+    /**
+     *  \brief  Strongest bin of |a*exp(j*phi_i) + b| over k phase hypotheses in one pass
+     *
+     *  Same result as evaluating every phase with its own rotate, add,
+     *  magnitude and argmax pass, but a and b are read once:
+     *  |a*s + b|^2 = |a|^2 + |b|^2 + 2*Re(a*conj(b)*s), so each block of bins
+     *  is reduced to |a|^2 + |b|^2 and a*conj(b), and the k hypotheses are
+     *  evaluated on that block while it is in cache. On ties the lowest phase
+     *  and then the lowest bin wins, like the sequential search.
+     *
+     *  \param  a, b
+     *          the two spectrum halves that are summed, len bins each
+     *  \param  len
+     *          number of bins
+     *  \param  cos_phi, sin_phi
+     *          cos/sin of the k phase offsets
+     *  \param  k
+     *          number of phase hypotheses
+     *  \param  scratch
+     *          volk aligned buffer of phase_search_scratch_len(k) floats
+     *  \param  p_max_val
+     *          receives the magnitude of the peak
+     */
+    inline uint32_t argmax_phase_sum_32fc(const gr_complex *a, const gr_complex *b, uint32_t len,
+                                          const float *cos_phi, const float *sin_phi, uint16_t k,
+                                          float *scratch, float *p_max_val)
+    {
+      gr_complex *cross = (gr_complex *)scratch;               // a*conj(b), 2 floats per bin
+      float *power      = &scratch[2*PHASE_SEARCH_BLOCK];      // |a|^2 + |b|^2
+      float *metric     = &scratch[3*PHASE_SEARCH_BLOCK];      // |a*s + b|^2 of the block for one phase
+      float *best_val   = &scratch[4*PHASE_SEARCH_BLOCK];      // running max per phase
+      uint32_t *best_idx = (uint32_t *)&best_val[k];
+
+      if (k == 0)
+      {
+        *p_max_val = 0;
+        return 0;
+      }
+
+      for (uint16_t i = 0; i < k; i++)
+      {
+        best_val[i] = -1;
+        best_idx[i] = 0;
+      }
+
+      for (uint32_t start = 0; start < len; start += PHASE_SEARCH_BLOCK)
+      {
+        const uint32_t n = std::min(PHASE_SEARCH_BLOCK, len - start);
+
+        volk_32fc_x2_multiply_conjugate_32fc(cross, &a[start], &b[start], n);
+        volk_32fc_magnitude_squared_32f(power, &a[start], n);
+        volk_32fc_magnitude_squared_32f(metric, &b[start], n);
+        volk_32f_x2_add_32f(power, power, metric, n);
+
+        for (uint16_t i = 0; i < k; i++)
+        {
+          const float c2 = 2*cos_phi[i];
+          const float s2 = 2*sin_phi[i];
+          for (uint32_t j = 0; j < n; j++)
+          {
+            metric[j] = power[j] + c2*cross[j].real() - s2*cross[j].imag();
+          }
+
+          float block_max;
+          uint32_t idx = argmax_32f(metric, &block_max, n);
+          if (block_max > best_val[i])
+          {
+            best_val[i] = block_max;
+            best_idx[i] = start + idx;
+          }
+        }
+      }
+
+      uint32_t max_idx = best_idx[0];
+      float    max_val = best_val[0];
+      for (uint16_t i = 1; i < k; i++)
+      {
+        if (best_val[i] > max_val)
+        {
+          max_val = best_val[i];
+          max_idx = best_idx[i];
+        }
+      }
+
+      // rounding can leave a (near) zero sum slightly negative
+      *p_max_val = std::sqrt(std::max(max_val, 0.0f));
+      return max_idx;
+    }
+
+    /**
+     *  \brief  The k largest values in descending order
+     *
+     *  Meant for small k (a handful of candidate peaks); values are kept in
+     *  a sorted array of k entries, so one pass over res costs O(len*k) in
+     *  the worst case but mostly a single compare per value. No demodulator
+     *  uses it yet, only benchmark_peak_search exercises it.
+     *
+     *  \param  res
+     *          non-negative values
+     *  \param  len
+     *          number of values
+     *  \param  k
+     *          number of peaks to return, at most len
+     *  \param  idx
+     *          receives k indices, idx[0] is the top-1 bin
+     *  \param  val
+     *          receives the k values at idx
+     */
+    inline void top_k_32f(const float *res, uint32_t len, uint32_t k, uint32_t *idx, float *val)
+    {
+      for (uint32_t j = 0; j < k; j++)
+      {
+        idx[j] = 0;
+        val[j] = -1;
+      }
+
+      for (uint32_t i = 0; i < len; i++)
+      {
+        if (res[i] <= val[k-1]) continue;
+
+        uint32_t j = k-1;
+        while (j > 0 && res[i] > val[j-1])
+        {
+          val[j] = val[j-1];
+          idx[j] = idx[j-1];
+          j--;
+        }
+        val[j] = res[i];
+        idx[j] = i;
+      }
+    }
+
+    /**
+     *  \brief  Bitmask of the strict local maxima above a threshold of a circular sequence
+     *
+     *  Bit i of mask is set when x[i] > thr, x[i] > x[i-1] and x[i] > x[i+1],
+     *  indices taken modulo len. Callers walk the set bits instead of
+     *  testing every bin.
+     *
+     *  \param  padded
+     *          len+2 values: x[len-1], x[0], ..., x[len-1], x[0]
+     *  \param  thr
+     *          len copies of the threshold
+     *  \param  scratch
+     *          scratch space of len floats
+     *  \param  mask
+     *          receives (len+63)/64 words, bit i%64 of word i/64 for x[i]
+     *  \param  len
+     *          number of values
+     */
+    inline void local_max_mask_32f(const float *padded, const float *thr, float *scratch, uint64_t *mask, uint32_t len)
+    {
+      // x[i] is a peak iff max(x[i-1], x[i+1], thr) - x[i] is negative
+      volk_32f_x2_max_32f(scratch, padded, padded + 2, len);
+      volk_32f_x2_max_32f(scratch, scratch, thr, len);
+      volk_32f_x2_subtract_32f(scratch, scratch, padded + 1, len);
+
+      for (uint32_t w = 0; w < (len + 63) / 64; w++)
+      {
+        const float *d = scratch + 64*w;
+        uint32_t n = std::min<uint32_t>(64, len - 64*w);
+        uint64_t bits = 0;
+        for (uint32_t j = 0; j < n; j++)
+        {
+          bits |= (uint64_t)std::signbit(d[j]) << j;
+        }
+        mask[w] = bits;
+      }
+    }
+
+  }
+}
+
+#endif /* PEAK_SEARCH_H */
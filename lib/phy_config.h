@@ -0,0 +1,98 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef PHY_CONFIG_H
+#define PHY_CONFIG_H
+
+#include <iostream>
+#include <stdexcept>
+#include <pmt/pmt.h>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  LoRa parameters that can be switched at runtime through a "config" message.
+     *
+     *  The message is a dict holding any of the keys "sf", "cr", "header", "crc",
+     *  "ldr" and "payload_len"; missing keys keep their current value.
+     */
+    struct phy_config
+    {
+      uint8_t sf;
+      uint8_t cr;
+      bool    header;
+      bool    crc;
+      bool    ldr;
+      uint8_t payload_len;
+    };
+
+    /**
+     *  \brief  Overwrite the fields of cfg given in the config message msg.
+     *
+     *  cfg is left untouched and false is returned if msg is not a dict,
+     *  holds a value of the wrong type or results in an invalid configuration.
+     */
+    inline bool update_phy_config(pmt::pmt_t msg, phy_config &cfg)
+    {
+      if (!pmt::is_dict(msg))
+      {
+        std::cerr << "Config message is not a dict, ignored." << std::endl;
+        return false;
+      }
+
+      // Numbers are range checked as read, before they are narrowed into the uint8_t fields
+      long sf          = cfg.sf;
+      long cr          = cfg.cr;
+      long payload_len = cfg.payload_len;
+      phy_config next  = cfg;
+      try
+      {
+        if (pmt::dict_has_key(msg, pmt::intern("sf")))          sf               = pmt::to_long(pmt::dict_ref(msg, pmt::intern("sf"), pmt::PMT_NIL));
+        if (pmt::dict_has_key(msg, pmt::intern("cr")))          cr               = pmt::to_long(pmt::dict_ref(msg, pmt::intern("cr"), pmt::PMT_NIL));
+        if (pmt::dict_has_key(msg, pmt::intern("header")))      next.header      = pmt::to_bool(pmt::dict_ref(msg, pmt::intern("header"), pmt::PMT_NIL));
+        if (pmt::dict_has_key(msg, pmt::intern("crc")))         next.crc         = pmt::to_bool(pmt::dict_ref(msg, pmt::intern("crc"), pmt::PMT_NIL));
+        if (pmt::dict_has_key(msg, pmt::intern("ldr")))         next.ldr         = pmt::to_bool(pmt::dict_ref(msg, pmt::intern("ldr"), pmt::PMT_NIL));
+        if (pmt::dict_has_key(msg, pmt::intern("payload_len"))) payload_len      = pmt::to_long(pmt::dict_ref(msg, pmt::intern("payload_len"), pmt::PMT_NIL));
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << "Malformed config message, ignored: " << e.what() << std::endl;
+        return false;
+      }
+
+      if (sf < 6 || sf > 12 || cr < 1 || cr > 4 || payload_len < 0 || payload_len > 255 || (sf == 6 && next.header))
+      {
+        std::cerr << "Invalid config (sf " << sf << ", cr " << cr << ", payload_len " << payload_len
+                  << ", header " << next.header << "), ignored." << std::endl;
+        return false;
+      }
+      next.sf          = sf;
+      next.cr          = cr;
+      next.payload_len = payload_len;
+
+      cfg = next;
+      return true;
+    }
+
+  }
+}
+
+#endif /* PHY_CONFIG_H */
@@ -33,6 +33,12 @@
 
 #define DUMP_IQ       0
 
+// Finalize expired packets on a worker thread, 0 finalizes them inside general_work
+#define ASYNC_FINALIZE  1
+
+// Hop a whole symbol at a time while no peak track or packet is open
+#define ADAPTIVE_HOP    1
+
 #define OVERLAP_FACTOR  8
 
 namespace gr {
@@ -44,10 +50,13 @@ namespace gr {
                          float beta,
                          uint16_t fft_factor,
                          float threshold,
-                         float fs_bw_ratio)
+                         float fs_bw_ratio,
+                         uint16_t max_tracks,
+                         uint16_t max_packets,
+                         uint8_t window)
     {
       return gnuradio::get_initial_sptr
-        (new pyramid_demod_impl(spreading_factor, low_data_rate, beta, fft_factor, threshold, fs_bw_ratio));
+        (new pyramid_demod_impl(spreading_factor, low_data_rate, beta, fft_factor, threshold, fs_bw_ratio, max_tracks, max_packets, window));
     }
 
     /*
@@ -58,7 +67,10 @@ namespace gr {
                             float beta,
                             uint16_t fft_factor,
                             float threshold,
-                            float fs_bw_ratio)
+                            float fs_bw_ratio,
+                            uint16_t max_tracks,
+                            uint16_t max_packets,
+                            uint8_t window)
       : gr::block("pyramid_demod",
               gr::io_signature::make(1, 1, sizeof(gr_complex)),
               gr::io_signature::make(0, 0, 0)),
@@ -71,12 +83,23 @@ namespace gr {
         d_ldr(low_data_rate),
         d_beta(beta),
         d_fft_size_factor(fft_factor),
-        d_threshold(threshold)
+        d_threshold(threshold),
+        d_dropped_tracks(0),
+        d_dropped_packets(0),
+        d_worker_stop(false),
+        d_inline_finalized(0),
+        d_hop_time_sum(0),
+        d_hop_time_max(0),
+        d_coarse(false),
+        d_fine_hold(0),
+        d_coarse_hops(0)
     {
       assert((d_sf > 5) && (d_sf < 13));
       if (d_sf == 6) assert(!header);
       assert(d_fft_size_factor > 0);
       assert(((int)fs_bw_ratio) == fs_bw_ratio);
+      assert(max_tracks > 0 && max_packets > 0);
+      assert(window == PY_WINDOW_KAISER || window == PY_WINDOW_BLACKMAN_HARRIS);
       d_p = (int) fs_bw_ratio;
 
       d_header_port = pmt::mp("header");
@@ -90,43 +113,82 @@ namespace gr {
       d_num_samples = d_p*d_num_symbols;
       d_bin_size = d_fft_size_factor*d_num_symbols;
       d_fft_size = d_fft_size_factor*d_num_samples;
-      d_fft = new fft::fft_complex(d_fft_size, true, 1);
+      // Consecutive hops never share a window, two slots hold the plain and windowed spectrum of one
+      d_stft = new stft(d_num_samples, d_fft_size_factor, d_bin_size, 2);
       d_overlaps = OVERLAP_FACTOR;
       d_ttl = 6*d_overlaps; // MAGIC
       d_offset = 0;
 
-      d_window = fft::window::build(fft::window::WIN_KAISER, d_num_samples, d_beta);
-
+      // Timestamps wrap at a multiple of the symbol length, so ts % d_num_samples keeps the
+      // symbol phase across the wrap also when d_p is not a power of two
+      d_ts_mod  = TIMESTAMP_MOD / d_num_samples * d_num_samples;
       d_ts_ref  = 0;
       d_bin_ref = 0;
       d_bin_tolerance = (d_ldr ? d_fft_size_factor * 2 : d_fft_size_factor / 2);
 
-      // Create local chirp tables.  Each table is 2 chirps long to allow memcpying from arbitrary offsets.
-      for (int i = 0; i < d_num_samples; i++) {
-        double phase = M_PI/d_p*(i-i*i/(float)d_num_samples);
-        d_downchirp.push_back(gr_complex(std::polar(1.0, phase)));
-        d_upchirp.push_back(gr_complex(std::polar(1.0, -phase)));
+      d_chirps   = gr::lora::get_chirp_tables(d_sf, d_p, d_beta);
+      d_ref_up   = d_stft->add_reference(d_chirps->downchirp);
+      if (window == PY_WINDOW_KAISER)
+      {
+        d_ref_up_w = d_stft->add_reference(d_chirps->downchirp, d_chirps->window);
+      }
+      else
+      {
+        // Scaled to the coherent gain of the Kaiser window, so that d_threshold means the same for both
+        float gain = std::accumulate(d_chirps->window.begin(), d_chirps->window.end(), 0.0f) / d_num_samples;
+        std::vector<float> coeffs = {0.35875f, -0.48829f, 0.14128f, -0.01168f};
+        for (auto & c : coeffs)
+        {
+          c *= gain / 0.35875f;
+        }
+        d_ref_up_w = d_stft->add_cosine_sum_window(d_ref_up, coeffs);
       }
 
-      uint16_t track_size = 1000; // MAGIC
+      // Pools start small and grow up to the caps, the bookkeeping around them is sized for the caps
       d_num_preamble = 6; // MAGIC
-      d_track.resize(track_size);
-      for (auto & v : d_track)
+      d_track.reset(64, max_tracks, d_overlaps * (d_num_preamble + 4));
+      d_bin_track_id_list.reserve(max_tracks);
+      d_track_updated.assign(max_tracks, false);
+      d_bin_owner.assign(d_bin_size, -1);
+      d_bin_center.assign(d_bin_size, -1);
+
+      d_packet.reset(8, max_packets, max_packet_symbol_len(d_sf, d_ldr) * 2);
+
+      // A refreshed deadline is at most d_ttl hops ahead, so a wheel longer than d_ttl never wraps onto itself
+      uint32_t wheel_size = 1;
+      while (wheel_size <= d_ttl) wheel_size <<= 1;
+      d_hop = 0;
+      d_timer_wheel.resize(wheel_size);
+      for (auto & slot : d_timer_wheel)
       {
-        v.reserve(d_overlaps * (d_num_preamble + 2));
+        slot.reserve(max_packets);
       }
-      d_bin_track_id_list.reserve(track_size);
-      for (uint16_t i = 0; i < track_size; i++)
+      d_timer_mask = wheel_size - 1;
+      d_packet_deadline.assign(max_packets, 0);
+      d_packet_gen.assign(max_packets, 0);
+      d_expired.reserve(max_packets);
+      d_phase_index.resize(4 * d_overlaps);
+      for (auto & bucket : d_phase_index)
       {
-        d_track_id_pool.push_back(i);
+        bucket.reserve(max_packets);
       }
-
-      uint16_t packet_id_size = 40; // MAGIC
-      d_packet.resize(packet_id_size);
-      d_packet_state_list.reserve(packet_id_size);
-      for (uint16_t i = 0; i < packet_id_size; i++)
+      d_packet_bucket.assign(max_packets, 0);
+      d_num_open_packets = 0;
+
+      d_up_block   = d_ws.alloc<gr_complex>(d_num_samples);
+      d_peak_pad     = d_ws.alloc<float>(d_bin_size + 2);
+      d_peak_thr     = d_ws.alloc<float>(d_bin_size);
+      d_peak_scratch = d_ws.alloc<float>(d_bin_size);
+      d_peak_mask    = d_ws.alloc<uint64_t>((d_bin_size + 63) / 64);
+      std::fill_n(d_peak_thr, d_bin_size, d_threshold);
+      d_ws.seal();
+
+      d_symbols.reserve(max_packet_symbol_len(d_sf, d_ldr));
+      d_worker_symbols.reserve(max_packet_symbol_len(d_sf, d_ldr));
+      d_finished.reset(max_packets);
+      for (size_t i = 0; i < d_finished.capacity(); i++)
       {
-        d_packet_id_pool.push_back(i);
+        d_finished.slot(i).peaks.reserve(max_packet_symbol_len(d_sf, d_ldr) * 2);
       }
 
       set_history(PY_DEMOD_HISTORY_DEPTH*d_num_samples);  // Sync is 2.25 symbols long
@@ -137,51 +199,72 @@ namespace gr {
      */
     pyramid_demod_impl::~pyramid_demod_impl()
     {
-      delete d_fft;
+      if (d_worker.joinable()) stop();
+      #if DEBUG >= DEBUG_INFO
+        std::cout << "hops: " << d_hop << " (" << d_coarse_hops << " symbol hops), mean hop latency: " << (d_hop ? d_hop_time_sum / d_hop / 1000.0 : 0) << " us, max hop latency: " << d_hop_time_max / 1000.0 << " us" << std::endl;
+        std::cout << "hops skipped by the squelch: " << d_squelch.gated() << std::endl;
+        std::cout << "packets finalized in general_work: " << d_inline_finalized << std::endl;
+        std::cout << "FFTs: " << d_stft->transforms() << ", derived windowed spectra: " << d_stft->derived() << std::endl;
+        std::cout << "workspace buffers allocated after construction: " << d_ws.late_allocations() << std::endl;
+        if (heap_counter::enabled()) std::cout << "heap allocations in general_work: " << d_heap.count() << std::endl;
+        std::cout << "track pool: " << d_track.size() << "/" << d_track.cap() << ", dropped tracks: " << d_dropped_tracks << std::endl;
+        std::cout << "packet pool: " << d_packet.size() << "/" << d_packet.cap() << ", dropped packets: " << d_dropped_packets << std::endl;
+      #endif
+      delete d_stft;
     }
 
-    uint32_t
-    pyramid_demod_impl::argmax_32f(float *fft_result, 
-                       bool update_squelch, float *max_val_p)
+    bool
+    pyramid_demod_impl::start()
     {
-      float mag   = abs(fft_result[0]);
-      float max_val = mag;
-      uint32_t max_idx = 0;
-
-      for (uint32_t i = 0; i < d_bin_size; i++)
-      {
-        mag = abs(fft_result[i]);
-        if (mag > max_val)
+      #if ASYNC_FINALIZE
+        if (!d_worker.joinable())
         {
-          max_idx = i;
-          max_val = mag;
+          d_worker_stop = false;
+          d_worker = std::thread(&pyramid_demod_impl::worker_loop, this);
         }
-      }
-
-      *max_val_p = max_val;
-      return max_idx;
+      #endif
+      return block::start();
     }
 
-    uint16_t
-    pyramid_demod_impl::argmax(gr_complex *fft_result, 
-                       bool update_squelch)
+    bool
+    pyramid_demod_impl::stop()
     {
-      float magsq   = pow(real(fft_result[0]), 2) + pow(imag(fft_result[0]), 2);
-      float max_val = magsq;
-      uint16_t max_idx = 0;
-
+      // The worker drains the queue before it exits
+      if (d_worker.joinable())
+      {
+        d_worker_stop = true;
+        d_worker_cv.notify_one();
+        d_worker.join();
+      }
+      return block::stop();
+    }
 
-      for (uint16_t i = 0; i < d_fft_size; i++)
+    void
+    pyramid_demod_impl::worker_loop()
+    {
+      for (;;)
       {
-        magsq = pow(real(fft_result[i]), 2) + pow(imag(fft_result[i]), 2);
-        if (magsq > max_val)
+        bool stopping = d_worker_stop;
+        while (!d_finished.empty())
         {
-          max_idx = i;
-          max_val = magsq;
+          finished_packet & fp = d_finished.front();
+          finalize_packet(fp.packet_id, fp.peaks, d_worker_symbols);
+          fp.peaks.clear();
+          d_finished.pop();
         }
+        if (stopping) break;
+
+        // notify_one() is sent without the lock, the timeout bounds a missed wakeup
+        std::unique_lock<std::mutex> lock(d_worker_mutex);
+        d_worker_cv.wait_for(lock, std::chrono::milliseconds(10),
+          [this] { return d_worker_stop || !d_finished.empty(); });
       }
+    }
 
-      return max_idx;
+    void
+    pyramid_demod_impl::set_squelch(float margin_db)
+    {
+      d_squelch.set_margin(margin_db);
     }
 
     float
@@ -223,61 +306,59 @@ namespace gr {
     // }
 
     void
-    pyramid_demod_impl::find_and_add_peak(float *fft_add, float *fft_add_w, float *fft_mag)
+    pyramid_demod_impl::find_and_add_peak(const float *fft_add, const float *fft_add_w, const float *fft_mag)
     {
-      for (uint32_t i = 0; i < d_bin_size; i++)
+      // Nothing to track if even the strongest bin is below the threshold
+      float max_val;
+      gr::lora::argmax_32f(fft_add_w, &max_val, d_bin_size);
+      if (max_val <= d_threshold) return;
+
+      // find peak: local maxima larger than d_threshold, the spectrum is padded with its wrapped neighbours
+      d_peak_pad[0] = fft_add_w[d_bin_size-1];
+      memcpy(d_peak_pad+1, fft_add_w, d_bin_size*sizeof(float));
+      d_peak_pad[d_bin_size+1] = fft_add_w[0];
+      gr::lora::local_max_mask_32f(d_peak_pad, d_peak_thr, d_peak_scratch, d_peak_mask, d_bin_size);
+
+      for (uint32_t w = 0; w < (d_bin_size + 63) / 64; w++)
       {
-        // find peak: search local maximum larger than d_threshold
-        uint32_t l_idx = gr::lora::pmod(i-1, d_bin_size);
-        uint32_t r_idx = gr::lora::pmod(i+1, d_bin_size);
-        if(fft_add_w[i] > d_threshold && fft_add_w[i] > fft_add_w[l_idx] && fft_add_w[i] > fft_add_w[r_idx])
+        for (uint64_t bits = d_peak_mask[w]; bits; bits &= bits - 1)
         {
+          uint32_t i = 64*w + __builtin_ctzll(bits);
           // this is a peak, insert it into the peak track
           uint32_t cur_bin = gr::lora::pmod(d_bin_size + i - d_bin_ref, d_bin_size);
-          bool found = false;
           uint16_t track_id;
-          for (auto & bt: d_bin_track_id_list)
+
+          // Abs(current_bin - target_bin) <= d_bin_tolerance, the oldest matching track wins
+          int32_t owner = d_bin_owner[cur_bin];
+          if (owner >= 0)
           {
-            uint32_t dis = gr::lora::pmod(d_bin_size + cur_bin - bt.bin, d_bin_size);
-            #if DEBUG >= DEBUG_VERBOSE_VERBOSE
-              std::cout << "dis: " << dis << ", bt.bin: " << bt.bin << std::endl;
-            #endif
-            // Abs(current_bin - target_bin) < d_bin_tolerance
-            if (dis <= d_bin_tolerance || dis >= d_bin_size - d_bin_tolerance)
-            {
-              found = true;
-              track_id = bt.track_id;
-              bt.updated = true;
-              break;
-            }
+            track_id = owner;
           }
-          if (!found)
+          else
           {
-            if (d_track_id_pool.empty())
-            {
-              std::cerr << "Current threshold is low! Increase the threshold or track size" << std::endl;
-              exit(-1);
-            }
-            track_id = d_track_id_pool.front();
-            d_track_id_pool.pop_front();
-            d_bin_track_id_list.push_back(bin_track_id(cur_bin, track_id, true));
+            if (!acquire_track(fft_add[i], track_id)) continue;
+            d_bin_track_id_list.push_back(bin_track_id(cur_bin, track_id));
+            claim_bins(cur_bin, track_id);
           }
+          d_track_updated[track_id] = true;
 
           #if DEBUG >= DEBUG_VERBOSE_VERBOSE
-            std::cout << "track id: " << track_id << ", track size: " << d_track[track_id].size() << ", track id pool size: " << d_track_id_pool.size() << ", bin: " << i << ", ref bin: " << d_bin_ref << ", peak height: " << fft_add[l_idx] << " " << fft_add[i] << " " << fft_add[r_idx] << " " << fft_add_w[i] << std::endl;
+            uint32_t l_idx = gr::lora::pmod(i-1, d_bin_size);
+            uint32_t r_idx = gr::lora::pmod(i+1, d_bin_size);
+            std::cout << "track id: " << track_id << ", track size: " << d_track.track_size(track_id) << ", tracks in use: " << d_track.in_use() << ", bin: " << i << ", ref bin: " << d_bin_ref << ", peak height: " << fft_add[l_idx] << " " << fft_add[i] << " " << fft_add[r_idx] << " " << fft_add_w[i] << std::endl;
           #endif
-          d_track[track_id].push_back(peak(d_ts_ref, i, fft_add[i], std::max(fft_mag[i], fft_mag[d_fft_size-d_bin_size+i])));
+          d_track.push_back(track_id, d_ts_ref, i, fft_add[i], std::max(fft_mag[i], fft_mag[d_fft_size-d_bin_size+i]));
         }
       }
     }
 
     void
-    pyramid_demod_impl::get_apex(std::vector<peak> &track, peak & pk, bool is_preamble)
+    pyramid_demod_impl::get_apex(const track_view &track, peak & pk, bool is_preamble)
     {
       float h[OVERLAP_FACTOR*2 + 10];
       for (int i = 0; i < track.size(); i++)
       {
-        h[i] = is_preamble ? track[i].h_single : track[i].h;
+        h[i] = is_preamble ? track.h_single(i) : track.h(i);
       }
       float max_h = h[0];
       uint16_t idx = 0;
@@ -290,15 +371,15 @@ namespace gr {
         }
       }
 #if APEX_ALGORITHM == APEX_ALGORITHM_SEGMENT
-      pk.ts  = track[idx].ts;
-      pk.bin = track[idx].bin;
+      pk.ts  = track.ts(idx);
+      pk.bin = track.bin(idx);
       pk.h   = h[idx];
 #elif APEX_ALGORITHM == APEX_ALGORITHM_LINEAR_REGRESSION
       // linear regression method requires at least 4 points
       if (idx < 1 || idx > track.size() - 2 || track.size() < 4)
       {
-        pk.ts  = track[idx].ts;
-        pk.bin = track[idx].bin;
+        pk.ts  = track.ts(idx);
+        pk.bin = track.bin(idx);
         pk.h   = h[idx];
       }
       else
@@ -308,10 +389,10 @@ namespace gr {
         linear_regression(h, 0, l_idx, &k1, &b1);
         linear_regression(h, l_idx+1, track.size()-1, &k2, &b2);
         float x = -(b2-b1)/(k2-k1);
-        pk.ts = gr::lora::pmod(track[l_idx].ts + round((x-l_idx)*d_num_samples/d_overlaps), TIMESTAMP_MOD);
+        pk.ts = gr::lora::pmod(track.ts(l_idx) + round((x-l_idx)*d_num_samples/d_overlaps), d_ts_mod);
         pk.h = k1 * x + b1;
         // std::cout << "k1: " << k1 << ", b1: " << b1 << ", k2: " << k2 << ", b2: " << b2 << ", x: " << x << std::endl;
-        pk.bin = gr::lora::pmod(track[l_idx].bin + round((x-l_idx)*d_bin_size/d_overlaps), d_bin_size);
+        pk.bin = gr::lora::pmod(track.bin(l_idx) + round((x-l_idx)*d_bin_size/d_overlaps), d_bin_size);
       }
 #endif
     }
@@ -319,14 +400,14 @@ namespace gr {
     symbol_type
     pyramid_demod_impl::get_central_peak(uint16_t track_id, peak & pk)
     {
-      auto track = d_track[track_id];
+      const track_view track = d_track.view(track_id);
       uint16_t len = track.size();
 
       #if DEBUG >= DEBUG_VERBOSE
         std::cout << "track id: " << track_id << ", peak height: ";
-        for (auto & pk : track)
+        for (uint32_t i = 0; i < len; i++)
         {
-          std::cout << pk.h << ", ";
+          std::cout << track.h(i) << ", ";
         }
         std::cout << std::endl;
       #endif
@@ -352,28 +433,27 @@ namespace gr {
         float max_h = -1;
         for (int i = r_idx; i < track.size(); i++)
         {
-          if (track[i].h > max_h)
+          if (track.h(i) > max_h)
           {
-            max_h = track[i].h;
+            max_h = track.h(i);
             r_idx = i;
           }
         }
         uint16_t start_idx = r_idx;
         for (; start_idx > r_idx - d_overlaps/2; start_idx--)
         {
-          if (track[start_idx-1].h_single > track[start_idx].h_single
-              || track[start_idx].h_single < d_threshold)
+          if (track.h_single(start_idx-1) > track.h_single(start_idx)
+              || track.h_single(start_idx) < d_threshold)
             break;
         }
 
-        std::vector<peak> track_cut(track.begin()+start_idx, track.end());
-        get_apex(track_cut, pk, true);
-        pk.ts = gr::lora::pmod(pk.ts + d_num_samples/4, TIMESTAMP_MOD);
+        get_apex(track.slice(start_idx, len), pk, true);
+        pk.ts = gr::lora::pmod(pk.ts + d_num_samples/4, d_ts_mod);
 
         float sum = 0;
         for (uint32_t i = d_overlaps*2; i < d_overlaps*(d_num_preamble-2); i++)
         {
-          sum += track[i].h;
+          sum += track.h(i);
         }
         pk.h = sum / (d_overlaps*(d_num_preamble-4));
         return SYMBOL_PREAMBLE;
@@ -403,10 +483,10 @@ namespace gr {
       if (st == SYMBOL_PREAMBLE)
       {
         // preamble detected, create a new packet
-        uint16_t pkt_id = d_packet_id_pool.front();
-        d_packet_id_pool.pop_front();
+        uint16_t pkt_id;
+        if (!acquire_packet(pk.h, pkt_id)) return false;
         d_packet[pkt_id].push_back(pk);
-        d_packet_state_list.push_back(packet_state(pkt_id, d_ttl));
+        open_packet(pkt_id);
         #if DEBUG >= DEBUG_INFO
           std::cout << "New preamble detected (ts:" << std::fixed << std::setprecision(2) << pk.ts/(float)d_num_samples << ", bin:" << pk.bin << ", h:" << pk.h << ") Packet#" << pkt_id << std::endl;
         #endif
@@ -414,33 +494,39 @@ namespace gr {
       }
       else if (st == SYMBOL_DATA)
       {
-        uint16_t pkt_idx  = 0;
         uint16_t pkt_id   = 0;
         float min_dis = std::numeric_limits<float>::infinity();
         bool found = false;
 
-        for (uint32_t i = 0; i < d_packet_state_list.size(); i++)
+        // Visit the phase buckets outwards from the one of the peak, a packet k buckets away
+        // is at least (k-1) buckets off in phase, so stop once that cannot beat min_dis
+        int num_buckets = d_phase_index.size();
+        int center = phase_bucket(pk.ts);
+        for (int k = 0; k <= num_buckets / 2; k++)
         {
-          // put peak into the best matched packet
-          auto const & ps = d_packet_state_list[i];
-          uint32_t ts_dis = gr::lora::pmod(pk.ts - d_packet[ps.packet_id][0].ts, TIMESTAMP_MOD);
-          // candidate symbols must have valid timestamp
-          if (ts_dis > 4 * d_num_samples && ts_dis < TIMESTAMP_MOD / 2)
+          if (k > 1 && 2.0f * (k - 1) / num_buckets >= min_dis) break;
+          for (int side = (k == 0 || 2 * k == num_buckets); side < 2; side++)
           {
-            float dis = gr::lora::pmod(ts_dis, d_num_samples) / (float) d_num_samples;
-            // In definition above, "dis->0" and "dis->1" both mean their timestamp differences to the actual timestamp is small
-            // therefore we transform dis to let "dis->1" represent larger difference
-            dis = (dis > 0.5) ? (1 - dis) * 2 : dis * 2;
-            // dis += std::abs(d_packet[ps.packet_id][0].h - pk.h) / d_packet[ps.packet_id][0].h;
-            float h_dis = std::abs(d_packet[ps.packet_id][0].h - pk.h) / d_packet[ps.packet_id][0].h;
-            // dis += h_dis;
-            // peak height difference should not be large
-            if (dis < min_dis && h_dis < 0.5)
+            for (uint16_t id : d_phase_index[gr::lora::pmod(center + (side ? k : -k), num_buckets)])
             {
-              found     = true;
-              pkt_idx   = i;
-              pkt_id    = ps.packet_id;
-              min_dis   = dis;
+              // put peak into the best matched packet
+              uint32_t ts_dis = gr::lora::pmod(pk.ts - d_packet[id][0].ts, d_ts_mod);
+              // candidate symbols must have valid timestamp
+              if (ts_dis > 4 * d_num_samples && ts_dis < d_ts_mod / 2)
+              {
+                float dis = gr::lora::pmod(ts_dis, d_num_samples) / (float) d_num_samples;
+                // In definition above, "dis->0" and "dis->1" both mean their timestamp differences to the actual timestamp is small
+                // therefore we transform dis to let "dis->1" represent larger difference
+                dis = (dis > 0.5) ? (1 - dis) * 2 : dis * 2;
+                float h_dis = std::abs(d_packet[id][0].h - pk.h) / d_packet[id][0].h;
+                // peak height difference should not be large
+                if (dis < min_dis && h_dis < 0.5)
+                {
+                  found     = true;
+                  pkt_id    = id;
+                  min_dis   = dis;
+                }
+              }
             }
           }
         }
@@ -448,7 +534,7 @@ namespace gr {
         if (found)
         {
           // new symbol added, reset TTL of the packet
-          d_packet_state_list[pkt_idx].ttl = d_ttl;
+          d_packet_deadline[pkt_id] = d_hop + d_ttl;
           d_packet[pkt_id].push_back(pk);
           #if DEBUG >= DEBUG_INFO
             std::cout << "Add symbol (ts:" << std::fixed << std::setprecision(2) << pk.ts/(float)d_num_samples << ", bin:" << pk.bin << ", h:" << pk.h << ") to Packet#" << pkt_id << std::endl;
@@ -458,7 +544,7 @@ namespace gr {
         else
         {
           #if DEBUG >= DEBUG_INFO
-            std::cout << "packet_state_list size: " << d_packet_state_list.size() << ", failed to classify symbol (ts:" << std::fixed << std::setprecision(2) << pk.ts/(float)d_num_samples << ", bin:" << pk.bin << ", h:" << pk.h << ")" << std::endl;
+            std::cout << "open packets: " << d_num_open_packets << ", failed to classify symbol (ts:" << std::fixed << std::setprecision(2) << pk.ts/(float)d_num_samples << ", bin:" << pk.bin << ", h:" << pk.h << ")" << std::endl;
           #endif
           return false;
         }
@@ -478,7 +564,7 @@ namespace gr {
       int erase_cnt = 0;
       for (auto const & bt : d_bin_track_id_list)
       {
-        if (!bt.updated)
+        if (!d_track_updated[bt.track_id])
         {
           erase_cnt++ ;
           // this peak tracking is over, extract the apex
@@ -500,8 +586,8 @@ namespace gr {
               }
             #endif
           }
-          d_track_id_pool.push_back(bt.track_id); // id recycle
-          d_track[bt.track_id].clear();           // track vector recycle
+          release_bins(bt.bin, bt.track_id);
+          d_track.release(bt.track_id);           // id and track vector recycle
         }
       }
       // #if DEBUG >= DEBUG_VERBOSE
@@ -511,7 +597,7 @@ namespace gr {
         std::remove_if(
           d_bin_track_id_list.begin(),
           d_bin_track_id_list.end(),
-          [](bin_track_id & bt) { return !bt.updated; }
+          [this](bin_track_id & bt) { return !d_track_updated[bt.track_id]; }
         ),
         d_bin_track_id_list.end()
       );
@@ -520,269 +606,405 @@ namespace gr {
       // #endif
       for (auto & bt : d_bin_track_id_list)
       {
-        bt.updated = false;
+        d_track_updated[bt.track_id] = false;
       }
     }
 
-    void
-    pyramid_demod_impl::forecast (int noutput_items,
-                          gr_vector_int &ninput_items_required)
+    bool
+    pyramid_demod_impl::acquire_track(float h, uint16_t & track_id)
     {
-      ninput_items_required[0] = noutput_items * (1 << d_sf);
+      if (d_track.acquire(track_id)) return true;
+
+      // Pool is full: the new peak replaces the weakest live track, unless it is weaker still
+      int weakest = -1;
+      float weakest_h = h;
+      for (int i = 0; i < d_bin_track_id_list.size(); i++)
+      {
+        const track_view track = d_track.view(d_bin_track_id_list[i].track_id);
+        float track_h = 0;
+        for (uint32_t j = 0; j < track.size(); j++)
+        {
+          track_h = std::max(track_h, track.h(j));
+        }
+        if (track_h < weakest_h)
+        {
+          weakest_h = track_h;
+          weakest = i;
+        }
+      }
+
+      if (d_dropped_tracks++ == 0)
+      {
+        std::cerr << "Track pool is full, dropping the weakest peaks. Increase the threshold or max_tracks" << std::endl;
+      }
+      if (weakest < 0) return false;
+
+      bin_track_id bt = d_bin_track_id_list[weakest];
+      d_bin_track_id_list.erase(d_bin_track_id_list.begin() + weakest);
+      release_bins(bt.bin, bt.track_id);
+      d_track_updated[bt.track_id] = false;
+      d_track.release(bt.track_id);
+      return d_track.acquire(track_id);
     }
 
-    int
-    pyramid_demod_impl::general_work (int noutput_items,
-                       gr_vector_int &ninput_items,
-                       gr_vector_const_void_star &input_items,
-                       gr_vector_void_star &output_items)
+    bool
+    pyramid_demod_impl::acquire_packet(float h, uint16_t & pkt_id)
     {
-      if (ninput_items[0] < 4*d_num_samples) return 0;
-      const gr_complex *in        = (const gr_complex *)  input_items[0];
-      uint32_t  *out          = (uint32_t   *) output_items[0];
-      uint32_t num_consumed   = d_num_samples / d_overlaps;
-      float max_val               = 0;
-      uint32_t max_index_sfd  = 0;
-      float max_val_sfd           = 0;
-      uint32_t tmp_idx        = 0;
-      // #if DEBUG >= DEBUG_VERBOSE
-      //   std::cout << "d_num_samples: " << d_num_samples <<  ", d_overlaps: " << d_overlaps << ", num_consumed: " << num_consumed << ", ts: " << d_ts_ref << std::endl;
-      // #endif
+      if (d_packet.acquire(pkt_id)) return true;
 
-      // Nomenclature:
-      //  up_block   == de-chirping buffer to contain upchirp features: the preamble, sync word, and data chirps
-      //  down_block == de-chirping buffer to contain downchirp features: the SFD
-      gr_complex *buffer     = (gr_complex *)volk_malloc(d_fft_size*sizeof(gr_complex), volk_get_alignment());
-      gr_complex *up_block   = (gr_complex *)volk_malloc(d_fft_size*sizeof(gr_complex), volk_get_alignment());
-      gr_complex *up_block_w = (gr_complex *)volk_malloc(d_fft_size*sizeof(gr_complex), volk_get_alignment());
-      gr_complex *down_block = (gr_complex *)volk_malloc(d_fft_size*sizeof(gr_complex), volk_get_alignment());
-      float *fft_mag     = (float*)volk_malloc(d_fft_size*sizeof(float), volk_get_alignment());
-      float *fft_mag_w   = (float*)volk_malloc(d_fft_size*sizeof(float), volk_get_alignment());
-      float *fft_add     = (float*)volk_malloc(d_bin_size*sizeof(float), volk_get_alignment());
-      float *fft_add_w   = (float*)volk_malloc(d_fft_size*sizeof(float), volk_get_alignment());
+      // Pool is full: the new preamble replaces the packet with the weakest preamble, unless it is weaker still
+      int weakest = -1;
+      float weakest_h = h;
+      for (auto const & bucket : d_phase_index)
+      {
+        for (uint16_t id : bucket)
+        {
+          if (d_packet[id][0].h < weakest_h)
+          {
+            weakest_h = d_packet[id][0].h;
+            weakest = id;
+          }
+        }
+      }
 
-      if (buffer == NULL || up_block == NULL || down_block == NULL)
+      if (d_dropped_packets++ == 0)
       {
-        std::cerr << "Unable to allocate processing buffer!" << std::endl;
+        std::cerr << "Packet pool is full, dropping the weakest packets. Increase max_packets" << std::endl;
       }
+      if (weakest < 0) return false;
 
-      // Dechirp the incoming signal
-      volk_32fc_x2_multiply_32fc(down_block, in, &d_upchirp[0], d_num_samples);
-      volk_32fc_x2_multiply_32fc(up_block, in, &d_downchirp[0], d_num_samples);
+      close_packet(weakest);
+      return d_packet.acquire(pkt_id);
+    }
 
-      // Enable to write IQ to disk for debugging
-      #if DUMP_IQ
-        f_up_windowless.write((const char*)&up_block[0], d_num_samples*sizeof(gr_complex));
-      #endif
+    uint32_t
+    pyramid_demod_impl::phase_bucket(uint32_t ts)
+    {
+      return (uint64_t)(ts % d_num_samples) * d_phase_index.size() / d_num_samples;
+    }
 
-      // Windowing
-      volk_32fc_32f_multiply_32fc(up_block_w, up_block, &d_window[0], d_num_samples);
+    void
+    pyramid_demod_impl::open_packet(uint16_t pkt_id)
+    {
+      d_packet_deadline[pkt_id] = d_hop + d_ttl;
+      d_timer_wheel[d_packet_deadline[pkt_id] & d_timer_mask].push_back(packet_timer(pkt_id, d_packet_gen[pkt_id]));
+      d_packet_bucket[pkt_id] = phase_bucket(d_packet[pkt_id][0].ts);
+      d_phase_index[d_packet_bucket[pkt_id]].push_back(pkt_id);
+      d_num_open_packets++;
+    }
 
-      #if DUMP_IQ
-        f_up.write((const char*)&up_block[0], d_num_samples*sizeof(gr_complex));
-      #endif
+    void
+    pyramid_demod_impl::close_packet(uint16_t pkt_id)
+    {
+      d_packet_gen[pkt_id]++;   // disarms the pending timer
+      auto & bucket = d_phase_index[d_packet_bucket[pkt_id]];
+      for (auto & id : bucket)
+      {
+        if (id == pkt_id)
+        {
+          id = bucket.back();
+          bucket.pop_back();
+          break;
+        }
+      }
+      d_num_open_packets--;
+      d_packet.release(pkt_id);
+    }
 
-      // Preamble and Data FFT
-      // If d_fft_size_factor is greater than 1, the rest of the sample buffer will be zeroed out and blend into the window
-      memset(d_fft->get_inbuf(),            0, d_fft_size*sizeof(gr_complex));
-      memcpy(d_fft->get_inbuf(), &up_block[0], d_num_samples*sizeof(gr_complex));
-      d_fft->execute();
-      #if DUMP_IQ
-        f_fft.write((const char*)d_fft->get_outbuf(), d_fft_size*sizeof(gr_complex));
+    void
+    pyramid_demod_impl::claim_bins(uint32_t bin, uint16_t track_id)
+    {
+      // Bins already owned stay with the older track, like the first match of a scan in creation order
+      d_bin_center[bin] = track_id;
+      for (int d = -(int)d_bin_tolerance; d <= (int)d_bin_tolerance; d++)
+      {
+        uint32_t b = gr::lora::pmod(bin + d, d_bin_size);
+        if (d_bin_owner[b] < 0) d_bin_owner[b] = track_id;
+      }
+    }
+
+    void
+    pyramid_demod_impl::release_bins(uint32_t bin, uint16_t track_id)
+    {
+      d_bin_center[bin] = -1;
+      for (int d = -(int)d_bin_tolerance; d <= (int)d_bin_tolerance; d++)
+      {
+        uint32_t b = gr::lora::pmod(bin + d, d_bin_size);
+        if (d_bin_owner[b] != track_id) continue;
+
+        // Track bins are more than d_bin_tolerance apart, so at most one other live track covers b
+        d_bin_owner[b] = -1;
+        for (int e = -(int)d_bin_tolerance; e <= (int)d_bin_tolerance; e++)
+        {
+          int32_t other = d_bin_center[gr::lora::pmod(b + e, d_bin_size)];
+          if (other >= 0)
+          {
+            d_bin_owner[b] = other;
+            break;
+          }
+        }
+      }
+    }
+
+    void
+    pyramid_demod_impl::finalize_packet(uint16_t pkt_id, std::vector<peak> & pkt, std::vector<uint16_t> & symbols)
+    {
+      // send the demodulation result to decoder
+      symbols.clear();
+
+      uint32_t pre_ts  = pkt[0].ts;     // preamble timestamp
+      uint32_t pre_bin = pkt[0].bin;    // preamble bin
+      float        pre_h   = pkt[0].h;      // preamble peak height
+      #if DEBUG >= DEBUG_VERBOSE_VERBOSE
+        std::cout << "preamble ts: " << pre_ts << ", preamble bin: " << pre_bin << std::endl;
+        std::cout << "ts: ";
+        for (uint32_t i = 1; i < pkt.size(); i++)
+        {
+          std::cout << pkt[i].ts << ", ";
+        }
+        std::cout << std::endl << "bin: ";
+        for (uint32_t i = 1; i < pkt.size(); i++)
+        {
+          std::cout << pkt[i].bin << ", ";
+        }
+        std::cout << std::endl;
       #endif
 
-      // fft result magnitude summation
-      volk_32fc_magnitude_32f(fft_mag, d_fft->get_outbuf(), d_fft_size);
-      volk_32f_x2_add_32f(fft_add, fft_mag, &fft_mag[d_bin_size], d_bin_size);
+      #if DEBUG >= DEBUG_INFO
+        std::cout << "Finished Packet#" << pkt_id << ": ";
+      #endif
 
-      // apply FFT on windowed signal
-      memset(d_fft->get_inbuf(),              0, d_fft_size*sizeof(gr_complex));
-      memcpy(d_fft->get_inbuf(), &up_block_w[0], d_num_samples*sizeof(gr_complex));
-      d_fft->execute();
-      volk_32fc_magnitude_32f(fft_mag_w, d_fft->get_outbuf(), d_fft_size);
-      volk_32f_x2_add_32f(fft_add_w, fft_mag_w, &fft_mag_w[d_bin_size], d_bin_size);
+      // set relative timestamp to preamble
+      // then ts_preamble = 0
+      for (auto & pk : pkt)
+      {
+        pk.ts = gr::lora::pmod(pk.ts-pre_ts, d_ts_mod);
+      }
+      pre_ts = 0;
 
-      // 1. peak tracking
-      find_and_add_peak(fft_add, fft_add_w, fft_mag);
-      // 2. stop tracking those peaks without updates, and push them into packet list
-      check_and_update_track();
-      // 3. check packets
-      for (auto const & ps : d_packet_state_list)
+      // sort peaks by their timestamps
+      sort(pkt.begin(), pkt.end(),
+        [](const peak & a, const peak & b) -> bool
       {
-        #if DEBUG >= DEBUG_VERBOSE_VERBOSE
-          std::cout << "packet id: " << ps.packet_id << ", ttl: " << ps.ttl << std::endl;
-        #endif
-        if (ps.ttl <= 0)
+        return a.ts < b.ts;
+      });
+
+      #if DEBUG >= DEBUG_VERBOSE
+        std::cout << std::endl;
+        for (auto & pk : pkt)
         {
-          // send the demodulation result to decoder
-          std::vector<uint16_t> symbols;
+          std::cout << "(ts: " << pk.ts/(float)d_num_samples << ", bin: " << pk.bin << ", h: " << pk.h << ")" << std::endl;
+        }
+      #endif
 
-          auto & pkt = d_packet[ps.packet_id];
-          uint32_t pre_ts  = pkt[0].ts;     // preamble timestamp
-          uint32_t pre_bin = pkt[0].bin;    // preamble bin
-          float        pre_h   = pkt[0].h;      // preamble peak height
-          #if DEBUG >= DEBUG_VERBOSE_VERBOSE
-            std::cout << "preamble ts: " << pre_ts << ", preamble bin: " << pre_bin << std::endl;
-            std::cout << "ts: ";
-            for (uint32_t i = 1; i < pkt.size(); i++)
-            {
-              std::cout << pkt[i].ts << ", ";
-            }
-            std::cout << std::endl << "bin: ";
-            for (uint32_t i = 1; i < pkt.size(); i++)
+      // LoRa PHY: Preamble + NetID(2) + SFD(2.25) + Data Payload
+      // There are 4.25 symbols between preamble and data payload
+      // ts_data - ts_preamble = 5*d_num_samples (ts_preamble has 0.25 fix in our implementation)
+      // The first data symbol timestamp is in ts_preamble+[4.5,5.5]*d_num_samples
+      uint32_t ts_interval_l = 4*d_num_samples + d_num_samples/2;
+      // "i" starts from 1, ignoring preamble
+      for (uint32_t start_idx = 1; start_idx < pkt.size(); )
+      {
+        bool is_first = true;
+        bool found = false;
+        uint32_t end_idx = start_idx;
+        for (; end_idx < pkt.size(); end_idx++)
+        {
+          if (is_first)
+          {
+            if ( pkt[end_idx].ts > ts_interval_l && pkt[end_idx].ts < ts_interval_l + d_num_samples )
             {
-              std::cout << pkt[i].bin << ", ";
+              start_idx = end_idx;
+              is_first = false;
+              found = true;
+              #if DEBUG >= DEBUG_VERBOSE
+                std::cout << std::endl << "pkt[end_idx].ts: " << pkt[end_idx].ts/(float)d_num_samples << ", ts_interval: " << ts_interval_l/(float)d_num_samples << ", r: " << (ts_interval_l + d_num_samples)/(float)d_num_samples << std::endl;
+              #endif
             }
-            std::cout << std::endl;
-
-            std::cout << " d_packet size: ";
-            for (uint32_t i = 0; i < d_packet.size(); i++)
+          }
+          else
+          {
+            if (!( pkt[end_idx].ts > ts_interval_l && pkt[end_idx].ts < ts_interval_l + d_num_samples ))
             {
-              std::cout << d_packet[i].size() << ",";
+              break;
             }
-            std::cout << std::endl;
+          }
+        }
 
-            std::cout << "current packet id: " << ps.packet_id << ", d_packet id: ";
-            for (uint32_t i = 0; i < d_packet_id_pool.size(); i++)
+        if (found)
+        {
+          // search the best matched peak for the packet
+          float min_dis = std::numeric_limits<float>::infinity();
+          uint32_t idx = start_idx;
+          for (uint32_t i = start_idx; i < end_idx; i++)
+          {
+            float dis = get_dis(pkt[i].ts, pkt[i].h, pre_ts, pre_h);
+            if (dis < min_dis)
             {
-              std::cout << d_packet_id_pool[i] << ",";
+              min_dis = dis;
+              idx = i;
             }
-            std::cout << std::endl;
-          #endif
-
-          #if DEBUG >= DEBUG_INFO
-            std::cout << "Finished Packet#" << ps.packet_id << ": ";
-          #endif
-
-          // set relative timestamp to preamble
-          // then ts_preamble = 0
-          for (auto & pk : pkt)
-          {
-            pk.ts = gr::lora::pmod(pk.ts-pre_ts, TIMESTAMP_MOD);
           }
-          pre_ts = 0;
 
-          // sort peaks by their timestamps
-          sort(pkt.begin(), pkt.end(),
-            [](const peak & a, const peak & b) -> bool
-          {
-            return a.ts < b.ts;
-          });
+          // ts could have overflowed
+          int bin_shift = gr::lora::pmod(pkt[idx].ts - pre_ts, d_num_samples) * d_bin_size / d_num_samples;
+          uint32_t bin = gr::lora::pmod(pkt[idx].bin - pre_bin - bin_shift, d_bin_size);
+          symbols.push_back(bin / d_fft_size_factor);
 
           #if DEBUG >= DEBUG_VERBOSE
-            std::cout << std::endl;
-            for (auto & pk : pkt)
-            {
-              std::cout << "(ts: " << pk.ts/(float)d_num_samples << ", bin: " << pk.bin << ", h: " << pk.h << ")" << std::endl;
-            }
+            std::cout << "bin: " << bin / d_fft_size_factor << ", packet bin: " << pkt[idx].bin << ", bin_shift: " << bin_shift << std::endl;
+          #elif DEBUG >= DEBUG_INFO
+            std::cout << bin / d_fft_size_factor << ",";
+          #endif
+        }
+        else
+        {
+          symbols.push_back(0);
+          #if DEBUG >= DEBUG_INFO
+            std::cout << "missing,";
           #endif
+        }
 
-          // LoRa PHY: Preamble + NetID(2) + SFD(2.25) + Data Payload
-          // There are 4.25 symbols between preamble and data payload
-          // ts_data - ts_preamble = 5*d_num_samples (ts_preamble has 0.25 fix in our implementation)
-          // The first data symbol timestamp is in ts_preamble+[4.5,5.5]*d_num_samples
-          uint32_t ts_interval_l = 4*d_num_samples + d_num_samples/2;
-          // "i" starts from 1, ignoring preamble
-          for (uint32_t start_idx = 1; start_idx < pkt.size(); )
-          {
-            bool is_first = true;
-            bool found = false;
-            uint32_t end_idx = start_idx;
-            for (; end_idx < pkt.size(); end_idx++)
-            {
-              if (is_first)
-              {
-                if ( pkt[end_idx].ts > ts_interval_l && pkt[end_idx].ts < ts_interval_l + d_num_samples )
-                {
-                  start_idx = end_idx;
-                  is_first = false;
-                  found = true;
-                  #if DEBUG >= DEBUG_VERBOSE
-                    std::cout << std::endl << "pkt[end_idx].ts: " << pkt[end_idx].ts/(float)d_num_samples << ", ts_interval: " << ts_interval_l/(float)d_num_samples << ", r: " << (ts_interval_l + d_num_samples)/(float)d_num_samples << std::endl;
-                  #endif
-                }
-              }
-              else
-              {
-                if (!( pkt[end_idx].ts > ts_interval_l && pkt[end_idx].ts < ts_interval_l + d_num_samples ))
-                {
-                  break;
-                }
-              }
-            }
+        start_idx = end_idx;
+        ts_interval_l = gr::lora::pmod(ts_interval_l + d_num_samples, d_ts_mod);
+      }
+      #if DEBUG >= DEBUG_INFO
+        std::cout << std::endl;
+      #endif
 
-            if (found)
-            {
-              // search the best matched peak for the packet
-              float min_dis = std::numeric_limits<float>::infinity();
-              uint32_t idx = start_idx;
-              for (uint32_t i = start_idx; i < end_idx; i++)
-              {
-                float dis = get_dis(pkt[i].ts, pkt[i].h, pre_ts, pre_h);
-                if (dis < min_dis)
-                {
-                  min_dis = dis;
-                  idx = i;
-                }
-              }
+      // LoRa data payload has at least 8 symbols
+      if (symbols.size() >= 8)
+      {
+        pmt::pmt_t dict = pmt::make_dict();
+        dict = pmt::dict_add(dict, pmt::intern("id"), pmt::intern("packet"));
+        pmt::pmt_t output = pmt::init_u16vector(symbols.size(), symbols);
+        pmt::pmt_t msg_pair = pmt::cons(dict, output);
+        message_port_pub(d_out_port, msg_pair);
+      }
+    }
 
-              // ts could have overflowed
-              int bin_shift = gr::lora::pmod(pkt[idx].ts - pre_ts, d_num_samples) * d_bin_size / d_num_samples;
-              uint32_t bin = gr::lora::pmod(pkt[idx].bin - pre_bin - bin_shift, d_bin_size);
-              symbols.push_back(bin / d_fft_size_factor);
+    void
+    pyramid_demod_impl::forecast (int noutput_items,
+                          gr_vector_int &ninput_items_required)
+    {
+      ninput_items_required[0] = noutput_items * (1 << d_sf);
+    }
 
-              #if DEBUG >= DEBUG_VERBOSE
-                std::cout << "bin: " << bin / d_fft_size_factor << ", packet bin: " << pkt[idx].bin << ", bin_shift: " << bin_shift << std::endl;
-              #elif DEBUG >= DEBUG_INFO
-                std::cout << bin / d_fft_size_factor << ",";
-              #endif
-            }
-            else
-            {
-              symbols.push_back(0);
-              #if DEBUG >= DEBUG_INFO
-                std::cout << "missing,";
-              #endif
-            }
+    int
+    pyramid_demod_impl::general_work (int noutput_items,
+                       gr_vector_int &ninput_items,
+                       gr_vector_const_void_star &input_items,
+                       gr_vector_void_star &output_items)
+    {
+      heap_counter::scope heap_scope(d_heap);
+      if (ninput_items[0] < 4*d_num_samples) return 0;
+      #if DEBUG >= DEBUG_INFO
+        auto hop_start = std::chrono::steady_clock::now();
+      #endif
+      const gr_complex *in        = (const gr_complex *)  input_items[0];
+      uint32_t  *out          = (uint32_t   *) output_items[0];
+      uint32_t num_consumed   = d_num_samples / d_overlaps;
+      float max_val               = 0;
+      uint32_t max_index_sfd  = 0;
+      float max_val_sfd           = 0;
+      uint32_t tmp_idx        = 0;
+      // #if DEBUG >= DEBUG_VERBOSE
+      //   std::cout << "d_num_samples: " << d_num_samples <<  ", d_overlaps: " << d_overlaps << ", num_consumed: " << num_consumed << ", ts: " << d_ts_ref << std::endl;
+      // #endif
 
-            start_idx = end_idx;
-            ts_interval_l = gr::lora::pmod(ts_interval_l + d_num_samples, TIMESTAMP_MOD);
-          }
-          #if DEBUG >= DEBUG_INFO
-            std::cout << std::endl;
-          #endif
+      // Stream offset of in[0], keys the cached spectra
+      const uint64_t pos = nitems_read(0) - (history() - 1);
 
-          // LoRa data payload has at least 8 symbols
-          if (symbols.size() >= 8)
-          {
-            pmt::pmt_t dict = pmt::make_dict();
-            dict = pmt::dict_add(dict, pmt::intern("id"), pmt::intern("packet"));
-            pmt::pmt_t output = pmt::init_u16vector(symbols.size(), symbols);
-            pmt::pmt_t msg_pair = pmt::cons(dict, output);
-            message_port_pub(d_out_port, msg_pair);
-          }
+      // Idle channel: probe the window one symbol ahead and hop a whole symbol while nothing in it
+      // crosses d_threshold. On a detection fine hopping restarts at in[0], one symbol before the
+      // probe, so the fine hops a starting preamble needs are not skipped
+      // The squelch gates the same window, on raw power, while nothing is open
+      bool idle = false;
+      if (d_squelch.enabled() && d_bin_track_id_list.empty() && d_num_open_packets == 0
+          && !d_squelch.update(in + d_num_samples, d_num_samples))
+      {
+        idle = true;
+      }
+      else if (ADAPTIVE_HOP && d_coarse)
+      {
+        float probe_max;
+        gr::lora::argmax_32f(d_stft->folded(pos + d_num_samples, in + d_num_samples, d_ref_up_w), &probe_max, d_bin_size);
+        idle = (probe_max <= d_threshold);
+        d_coarse = idle;
+        // The probed window is d_overlaps fine hops ahead, stay fine until it has been searched
+        if (!idle) d_fine_hold = d_overlaps;
+      }
 
-          pkt.clear();
-          d_packet_id_pool.push_back(ps.packet_id);
-        }
+      if (idle)
+      {
+        // d_bin_ref moves d_bin_size per symbol, i.e. stays put
+        num_consumed = d_num_samples;
+        d_coarse_hops++;
       }
+      else
+      {
+        // Enable to write IQ to disk for debugging
+        #if DUMP_IQ
+          volk_32fc_x2_multiply_32fc(d_up_block, in, &d_chirps->downchirp[0], d_num_samples);
+          f_up_windowless.write((const char*)&d_up_block[0], d_num_samples*sizeof(gr_complex));
+          f_up.write((const char*)&d_up_block[0], d_num_samples*sizeof(gr_complex));
+          f_fft.write((const char*)d_stft->spectrum(pos, in, d_ref_up), d_fft_size*sizeof(gr_complex));
+        #endif
 
-      // packets with negative ttl have been sent to decoder by the above for loop
-      d_packet_state_list.erase(
-        std::remove_if(
-          d_packet_state_list.begin(),
-          d_packet_state_list.end(),
-          [](packet_state const & ps) { return ps.ttl <= 0; }
-        ),
-        d_packet_state_list.end()
-      );
-      for (auto & ps : d_packet_state_list)
+        // Preamble and Data FFT of the dechirped signal, plain and windowed
+        // If d_fft_size_factor is greater than 1, the spectrum is the one of the zero-padded symbol
+        const float *fft_mag   = d_stft->magnitude(pos, in, d_ref_up);
+        const float *fft_add   = d_stft->folded(pos, in, d_ref_up);
+        const float *fft_add_w = d_stft->folded(pos, in, d_ref_up_w);
+
+        // 1. peak tracking
+        find_and_add_peak(fft_add, fft_add_w, fft_mag);
+        // 2. stop tracking those peaks without updates, and push them into packet list
+        check_and_update_track();
+
+        d_bin_ref  = gr::lora::pmod(d_bin_ref + d_bin_size / d_overlaps, d_bin_size);
+        // Nothing tracked, nothing left to finalize and the probed window reached, go back to symbol hops
+        if (d_fine_hold > 0) d_fine_hold--;
+        d_coarse = ADAPTIVE_HOP && d_fine_hold == 0 && d_bin_track_id_list.empty() && d_num_open_packets == 0;
+      }
+      // 3. finalize the packets whose TTL runs out in this hop
+      auto & slot = d_timer_wheel[d_hop & d_timer_mask];
+      d_expired.clear();
+      for (auto const & t : slot)
       {
-        ps.ttl -= 1;
+        // the packet was closed after this timer was armed
+        if (t.gen != d_packet_gen[t.packet_id]) continue;
+        uint64_t deadline = d_packet_deadline[t.packet_id];
+        #if DEBUG >= DEBUG_VERBOSE_VERBOSE
+          std::cout << "packet id: " << t.packet_id << ", ttl: " << (int64_t)(deadline - d_hop) << std::endl;
+        #endif
+        if (deadline <= d_hop) d_expired.push_back(t.packet_id);
+        else d_timer_wheel[deadline & d_timer_mask].push_back(t);   // TTL was refreshed, re-arm
       }
+      slot.clear();
+      bool queued = false;
+      for (uint16_t pkt_id : d_expired)
+      {
+        if (ASYNC_FINALIZE && d_worker.joinable() && !d_finished.full())
+        {
+          // hand the peaks to the worker, the slab gets the slot's (empty, reserved) vector back
+          finished_packet & fp = d_finished.back();
+          fp.packet_id = pkt_id;
+          fp.peaks.swap(d_packet[pkt_id]);
+          d_finished.push();
+          queued = true;
+        }
+        else
+        {
+          d_inline_finalized++;
+          finalize_packet(pkt_id, d_packet[pkt_id], d_symbols);
+        }
+        close_packet(pkt_id);
+      }
+      if (queued) d_worker_cv.notify_one();
+      d_hop++;
 
-      d_ts_ref   = gr::lora::pmod(d_ts_ref + d_num_samples / d_overlaps, TIMESTAMP_MOD);
-      d_bin_ref  = gr::lora::pmod(d_bin_ref + d_bin_size / d_overlaps, d_bin_size);
+      d_ts_ref   = gr::lora::pmod(d_ts_ref + num_consumed, d_ts_mod);
 
       #if DUMP_IQ
         f_raw.write((const char*)&in[0], num_consumed*sizeof(gr_complex));
@@ -790,14 +1012,11 @@ namespace gr {
 
       consume_each(num_consumed);
 
-      free(down_block);
-      free(up_block);
-      free(up_block_w);
-      free(buffer);
-      free(fft_mag);
-      free(fft_mag_w);
-      free(fft_add);
-      free(fft_add_w);
+      #if DEBUG >= DEBUG_INFO
+        uint64_t hop_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - hop_start).count();
+        d_hop_time_sum += hop_time;
+        d_hop_time_max = std::max(d_hop_time_max, hop_time);
+      #endif
 
       return noutput_items;
     }
@@ -29,11 +29,26 @@
 #include <complex>
 #include <fstream>
 #include <limits>
+#include <numeric>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <gnuradio/fft/fft.h>
 #include <gnuradio/fft/window.h>
 #include <volk/volk.h>
 #include <lora/pyramid_demod.h>
 #include "utilities.h"
+#include "peak_search.h"
+#include "stft.h"
+#include "dsp_registry.h"
+#include "workspace.h"
+#include "heap_counter.h"
+#include "slab_pool.h"
+#include "track_arena.h"
+#include "spsc_queue.h"
+#include "squelch.h"
 
 namespace gr {
   namespace lora {
@@ -56,9 +71,8 @@ namespace gr {
     struct bin_track_id {
       uint32_t     bin;           // peak bin
       uint16_t   track_id;      // index to reference peak_track
-      bool             updated;       // whether a peak tracking process is over
-      bin_track_id(uint32_t bin, uint16_t track_id, bool updated)
-        : bin(bin), track_id(track_id), updated(updated)
+      bin_track_id(uint32_t bin, uint16_t track_id)
+        : bin(bin), track_id(track_id)
       {}
       // bin_track_id(bin_track_id && other)
       //   : bin(other.bin), track_id(other.track_id), updated(other.updated)
@@ -66,14 +80,19 @@ namespace gr {
       // bin_track_id& operator=(const bin_track_id & other) = default;
     };
 
-    struct packet_state {
+    struct packet_timer {
       uint16_t   packet_id;     // index to reference packet list
-      short   ttl;           // time to live
-      packet_state(uint16_t packet_id, uint16_t ttl)
-        : packet_id(packet_id), ttl(ttl)
+      uint32_t   gen;           // stale unless equal to d_packet_gen[packet_id]
+      packet_timer(uint16_t packet_id, uint32_t gen)
+        : packet_id(packet_id), gen(gen)
       {}
     };
 
+    struct finished_packet {
+      uint16_t          packet_id;
+      std::vector<peak> peaks;
+    };
+
     class pyramid_demod_impl : public pyramid_demod
     {
      private:
@@ -96,9 +115,8 @@ namespace gr {
       uint16_t  d_num_preamble;
 
       float           d_cfo;
-      float           d_power;
       float           d_threshold;
-      bool            d_squelched;
+      power_squelch   d_squelch;
 
       uint32_t    d_preamble_idx;
       uint16_t  d_sfd_idx;
@@ -108,22 +126,70 @@ namespace gr {
 
       uint32_t    d_bin_ref;
       uint32_t    d_ts_ref;
-      std::vector<std::vector<peak>>        d_track;
+      uint32_t    d_ts_mod;     // timestamps are kept modulo d_ts_mod
+      track_arena                           d_track;
       std::vector<bin_track_id>             d_bin_track_id_list;
-      std::deque<uint16_t>            d_track_id_pool;
-      std::vector<std::vector<peak>>        d_packet;
-      std::vector<packet_state>             d_packet_state_list;
-      std::deque<uint16_t>            d_packet_id_pool;
-
-      fft::fft_complex   *d_fft;
-      std::vector<float> d_window;
+      std::vector<uint8_t>                  d_track_updated;  // whether track_id got a peak this hop
+      // Bin index of the live tracks, both d_bin_size long, -1 where empty:
+      //  d_bin_owner[b]  == the oldest track with |b - track bin| <= d_bin_tolerance (circular)
+      //  d_bin_center[b] == the track started at bin b
+      std::vector<int32_t>                  d_bin_owner;
+      std::vector<int32_t>                  d_bin_center;
+      slab_pool<peak>                       d_packet;
+      // Packet expiry: a hashed timer wheel indexed by hop count. Each open packet has one live timer;
+      // a timer that fires before d_packet_deadline (the TTL was refreshed) re-arms itself there
+      uint64_t                              d_hop;
+      std::vector<std::vector<packet_timer>> d_timer_wheel;
+      uint32_t                              d_timer_mask;
+      std::vector<uint64_t>                 d_packet_deadline;
+      std::vector<uint32_t>                 d_packet_gen;
+      std::vector<uint16_t>                 d_expired;
+      // Open packets bucketed by preamble timestamp phase (ts % d_num_samples)
+      std::vector<std::vector<uint16_t>>    d_phase_index;
+      std::vector<uint16_t>                 d_packet_bucket;
+      uint16_t                              d_num_open_packets;
+      // Overload accounting, a peak or preamble lost to a full pool counts as one drop
+      uint64_t  d_dropped_tracks;
+      uint64_t  d_dropped_packets;
+
+      stft               *d_stft;
+      int                d_ref_up;     // dechirps upchirps
+      int                d_ref_up_w;   // dechirps upchirps, windowed (Kaiser, or Blackman-Harris from d_ref_up)
       float              d_beta;
 
-      std::vector<gr_complex> d_upchirp;
-      std::vector<gr_complex> d_downchirp;
+      // Chirp tables and Kaiser window, shared with the other blocks using them
+      std::shared_ptr<const chirp_tables> d_chirps;
 
       std::vector<uint16_t> d_symbols;
 
+      // Expired packets are finalized (sorted, turned into symbols, published) on d_worker.
+      // Their peaks are swapped into d_finished, the DSP thread only does FFT and tracking
+      spsc_queue<finished_packet> d_finished;
+      std::thread             d_worker;
+      std::mutex              d_worker_mutex;
+      std::condition_variable d_worker_cv;
+      std::atomic<bool>       d_worker_stop;
+      std::vector<uint16_t>   d_worker_symbols;
+      uint64_t                d_inline_finalized;   // d_finished was full or the worker was not running
+
+      // Idle channel mode, hops one symbol instead of 1/d_overlaps symbol
+      bool      d_coarse;
+      uint16_t  d_fine_hold;      // fine hops left after a probe hit before d_coarse may be set again
+      uint64_t  d_coarse_hops;
+
+      // Hop latency statistics, DEBUG_INFO only
+      uint64_t  d_hop_time_sum;
+      uint64_t  d_hop_time_max;
+
+      // Processing buffers, sized once in the constructor
+      workspace   d_ws;
+      heap_counter d_heap;
+      gr_complex *d_up_block;
+      float      *d_peak_pad;       // circularly padded windowed spectrum, d_bin_size + 2
+      float      *d_peak_thr;       // d_threshold repeated
+      float      *d_peak_scratch;
+      uint64_t   *d_peak_mask;      // local maxima of the windowed spectrum, one bit per bin
+
       std::ofstream f_raw, f_up_windowless, f_up, f_down, f_fft;
 
      public:
@@ -132,20 +198,35 @@ namespace gr {
                          float beta,
                          uint16_t fft_factor,
                          float threshold,
-                         float fs_bw_ratio);
+                         float fs_bw_ratio,
+                         uint16_t max_tracks,
+                         uint16_t max_packets,
+                         uint8_t window);
       ~pyramid_demod_impl();
 
-      uint16_t argmax(gr_complex *fft_result, bool update_squelch);
-      uint32_t argmax_32f(float *fft_result, bool update_squelch, float *max_val_p);
       float get_dis(uint32_t ts1, float h1, uint32_t ts2, float h2);
 
       // void parse_header(pmt::pmt_t dict);
 
-      void find_and_add_peak(float *fft_mag_add, float *fft_mag_add_w, float *fft_mag);
-      void get_apex(std::vector<peak> & track, peak & pk, bool is_preamble=false);
+      void find_and_add_peak(const float *fft_mag_add, const float *fft_mag_add_w, const float *fft_mag);
+      void get_apex(const track_view & track, peak & pk, bool is_preamble=false);
       symbol_type get_central_peak(uint16_t track_id, peak & pk);
       bool add_symbol_to_packet(peak & pk, symbol_type st);
+      bool acquire_track(float h, uint16_t & track_id);
+      bool acquire_packet(float h, uint16_t & pkt_id);
+      void open_packet(uint16_t pkt_id);
+      void close_packet(uint16_t pkt_id);
+      uint32_t phase_bucket(uint32_t ts);
+      void finalize_packet(uint16_t pkt_id, std::vector<peak> & pkt, std::vector<uint16_t> & symbols);
+      void worker_loop();
       void check_and_update_track();
+      void claim_bins(uint32_t bin, uint16_t track_id);
+      void release_bins(uint32_t bin, uint16_t track_id);
+
+      void set_squelch(float margin_db);
+
+      bool start();
+      bool stop();
 
       // Where all the action really happens
       void forecast(int noutput_items, gr_vector_int &ninput_items_required);
@@ -0,0 +1,69 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gnuradio/attributes.h>
+#include <boost/test/unit_test.hpp>
+#include "fec.h"
+
+namespace gr {
+  namespace lora {
+
+    BOOST_AUTO_TEST_CASE(test_fec_round_trip)
+    {
+      const fec_tables &fec = fec_tables::get();
+      for (int cr = 1; cr <= 4; cr++)
+      {
+        for (int n = 0; n < 16; n++)
+        {
+          uint8_t codeword = fec.encode[cr-1][n];
+          BOOST_REQUIRE_EQUAL(codeword >> (4 + cr), 0);
+          BOOST_CHECK_EQUAL(fec.decode[cr-1][codeword], n);
+        }
+      }
+    }
+
+    BOOST_AUTO_TEST_CASE(test_fec_single_bit_errors)
+    {
+      const fec_tables &fec = fec_tables::get();
+      for (int cr = 1; cr <= 4; cr++)
+      {
+        for (int n = 0; n < 16; n++)
+        {
+          uint8_t codeword = fec.encode[cr-1][n];
+          for (int bit = 0; bit < 4 + cr; bit++)
+          {
+            uint8_t received = codeword ^ (1 << bit);
+            if (cr >= 3 || bit >= 4)
+            {
+              // CR 4/7 and 4/8 correct any single bit, a parity bit error never touches the data
+              BOOST_CHECK_EQUAL(fec.decode[cr-1][received], n);
+            }
+            else
+            {
+              // CR 4/5 and 4/6 only detect errors, a data bit error goes through
+              BOOST_CHECK_EQUAL(fec.decode[cr-1][received], n ^ (1 << bit));
+            }
+          }
+        }
+      }
+    }
+
+  } /* namespace lora */
+} /* namespace gr */
@@ -0,0 +1,111 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <gnuradio/attributes.h>
+#include <boost/test/unit_test.hpp>
+#include <lora/lora.h>
+#include "stream_decoder.h"
+
+namespace gr {
+  namespace lora {
+
+    // lora::encode output for "gr-lora stream" at SF 8, CR 4/7, explicit header and CRC
+    static const uint8_t test_sf = 8;
+    static const uint16_t test_symbols[] = {
+       29,   9, 249,  97, 125,  25, 253, 125,
+      146, 128, 201, 173, 213,  54,  45,
+       54,  55,  16, 212, 103,  87, 253,
+      174, 222,  70,  26,  32, 228, 160,
+      118,   1, 136,  63, 135, 160,  18
+    };
+    // header, payload and CRC as lora::decode emits them
+    static const uint8_t test_frame[] = {
+      0x0e, 0x70, 0x00,
+      0x67, 0x72, 0x2d, 0x6c, 0x6f, 0x72, 0x61, 0x20, 0x73, 0x74, 0x72, 0x65, 0x61, 0x6d,
+      0x49, 0x10
+    };
+
+    static void
+    check_frame(const stream_decoder &decoder)
+    {
+      BOOST_REQUIRE(decoder.done());
+      BOOST_CHECK(decoder.crc_ok());
+      BOOST_CHECK_EQUAL(decoder.header().payload_len, 14);
+      BOOST_CHECK_EQUAL(decoder.header().cr, 3);
+      BOOST_CHECK(decoder.header().crc);
+      BOOST_CHECK_EQUAL_COLLECTIONS(decoder.bytes().begin(), decoder.bytes().end(),
+                                    test_frame, test_frame + sizeof(test_frame));
+    }
+
+    BOOST_AUTO_TEST_CASE(test_stream_decoder_whole_packet)
+    {
+      // The way lora::decode walks a complete packet
+      const size_t num_symbols = sizeof(test_symbols)/sizeof(test_symbols[0]);
+      stream_decoder decoder;
+      decoder.reset(test_sf, true, false, 1, false, 0);
+      BOOST_REQUIRE(decoder.push_block(test_symbols));
+      for (size_t i = 8; !decoder.done() && i + decoder.block_len() <= num_symbols; i += decoder.block_len())
+      {
+        BOOST_REQUIRE(decoder.push_block(&test_symbols[i]));
+      }
+      check_frame(decoder);
+    }
+
+    BOOST_AUTO_TEST_CASE(test_stream_decoder_block_by_block)
+    {
+      // The way lora::demod feeds symbols while the packet is received
+      const size_t num_symbols = sizeof(test_symbols)/sizeof(test_symbols[0]);
+      stream_decoder decoder;
+      decoder.reset(test_sf, true, false, 1, false, 0);
+
+      std::vector<uint16_t> received;
+      size_t block_end = 8;
+      for (size_t i = 0; i < num_symbols; i++)
+      {
+        received.push_back(test_symbols[i]);
+        if (received.size() != block_end)
+        {
+          continue;
+        }
+
+        BOOST_REQUIRE(!decoder.done());
+        BOOST_REQUIRE(decoder.push_block(&received[received.size() - decoder.block_len()]));
+        block_end += decoder.block_len();
+
+        // every byte out so far is final
+        const std::vector<uint8_t> &bytes = decoder.bytes();
+        BOOST_REQUIRE(bytes.size() <= sizeof(test_frame));
+        BOOST_CHECK_EQUAL_COLLECTIONS(bytes.begin(), bytes.end(), test_frame, test_frame + bytes.size());
+      }
+      BOOST_CHECK_EQUAL(received.size() + decoder.block_len(), block_end);
+      check_frame(decoder);
+    }
+
+    BOOST_AUTO_TEST_CASE(test_stream_decoder_invalid_cr)
+    {
+      stream_decoder decoder;
+      decoder.reset(test_sf, false, false, 0, true, 14);
+      BOOST_CHECK(!decoder.header().valid);
+      BOOST_CHECK(!decoder.push_block(test_symbols));
+      BOOST_CHECK(decoder.bytes().empty());
+    }
+
+  } /* namespace lora */
+} /* namespace gr */
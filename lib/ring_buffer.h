@@ -0,0 +1,81 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <cstddef>
+#include <vector>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Fixed-capacity ring buffer, storage is allocated once by reset().
+     *
+     *  push_back() on a full ring drops the oldest element, so a ring of
+     *  capacity n keeps the n most recent values.
+     *  operator[] counts from the oldest element, recent() from the newest.
+     */
+    template <typename T>
+    class fixed_ring
+    {
+     public:
+      explicit fixed_ring(size_t capacity = 0) { reset(capacity); }
+
+      void reset(size_t capacity)
+      {
+        d_buf.assign(capacity, T());
+        d_head = 0;
+        d_size = 0;
+      }
+
+      void push_back(const T &v)
+      {
+        d_buf[wrap(d_head + d_size)] = v;
+        if (d_size < d_buf.size()) d_size++;
+        else d_head = wrap(d_head + 1);
+      }
+
+      void clear() { d_head = 0; d_size = 0; }
+
+      T &operator[](size_t i) { return d_buf[wrap(d_head + i)]; }
+      const T &operator[](size_t i) const { return d_buf[wrap(d_head + i)]; }
+
+      T &recent(size_t i = 0) { return d_buf[wrap(d_head + d_size - 1 - i)]; }
+      const T &recent(size_t i = 0) const { return d_buf[wrap(d_head + d_size - 1 - i)]; }
+
+      size_t size() const { return d_size; }
+      size_t capacity() const { return d_buf.size(); }
+      bool empty() const { return d_size == 0; }
+      bool full() const { return d_size == d_buf.size(); }
+
+     private:
+      size_t wrap(size_t i) const { return i < d_buf.size() ? i : i - d_buf.size(); }
+
+      std::vector<T> d_buf;
+      size_t         d_head;
+      size_t         d_size;
+    };
+
+  }
+}
+
+#endif /* RING_BUFFER_H */
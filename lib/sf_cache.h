@@ -0,0 +1,75 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SF_CACHE_H
+#define SF_CACHE_H
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Tables of a block that depend on the spreading factor, built once per spreading factor.
+     *
+     *  get(sf, build) calls build(sf) for a new T the first time sf is asked
+     *  for and returns the stored entry afterwards, so switching back to a
+     *  spreading factor that was used before costs a lookup. Entries live
+     *  as long as the cache.
+     */
+    template <typename T>
+    class sf_cache
+    {
+     public:
+      sf_cache() : d_built(0) { d_entries.fill(NULL); }
+
+      ~sf_cache()
+      {
+        for (auto e : d_entries) delete e;
+      }
+
+      template <typename F>
+      T &get(uint8_t sf, F build)
+      {
+        assert(sf < d_entries.size());
+        if (d_entries[sf] == NULL)
+        {
+          d_entries[sf] = build(sf);
+          d_built++;
+        }
+        return *d_entries[sf];
+      }
+
+      uint32_t built() const { return d_built; }
+
+     private:
+      sf_cache(const sf_cache &);
+      sf_cache &operator=(const sf_cache &);
+
+      std::array<T *, 13> d_entries;
+      uint32_t            d_built;
+    };
+
+  }
+}
+
+#endif /* SF_CACHE_H */
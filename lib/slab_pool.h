@@ -0,0 +1,109 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Growable pool of reusable vectors (slabs) addressed by a small integer id.
+     *
+     *  Slabs are created on demand, doubling up to a fixed cap, and keep their
+     *  storage when released, so once the pool has grown to the working set no
+     *  further allocation happens. The outer table is reserved for the cap up
+     *  front, references to slabs stay valid while the pool grows.
+     *  acquire() fails instead of growing past the cap, the caller decides
+     *  what to drop.
+     */
+    template <typename T>
+    class slab_pool
+    {
+     public:
+      slab_pool() : d_cap(0), d_slab_reserve(0) {}
+
+      void reset(size_t initial, size_t cap, size_t slab_reserve)
+      {
+        d_cap = cap;
+        d_slab_reserve = slab_reserve;
+        d_slabs.clear();
+        d_slabs.reserve(cap);
+        d_free.clear();
+        d_free.reserve(cap);
+        grow(initial < cap ? initial : cap);
+      }
+
+      bool acquire(uint16_t &id)
+      {
+        if (d_free.empty())
+        {
+          if (d_slabs.size() >= d_cap) return false;
+          grow(d_slabs.empty() ? 1 : d_slabs.size());
+        }
+        id = d_free.back();
+        d_free.pop_back();
+        return true;
+      }
+
+      void release(uint16_t id)
+      {
+        d_slabs[id].clear();
+        d_free.push_back(id);
+      }
+
+      std::vector<T> &operator[](uint16_t id) { return d_slabs[id]; }
+      const std::vector<T> &operator[](uint16_t id) const { return d_slabs[id]; }
+
+      size_t size() const { return d_slabs.size(); }        // slabs created so far
+      size_t in_use() const { return d_slabs.size() - d_free.size(); }
+      size_t cap() const { return d_cap; }
+
+     private:
+      void grow(size_t n)
+      {
+        size_t end = d_slabs.size() + n;
+        if (end > d_cap) end = d_cap;
+        // Hand out low ids first
+        for (size_t i = end; i-- > d_slabs.size(); )
+        {
+          d_free.push_back(i);
+        }
+        while (d_slabs.size() < end)
+        {
+          d_slabs.emplace_back();
+          d_slabs.back().reserve(d_slab_reserve);
+        }
+      }
+
+      std::vector<std::vector<T>> d_slabs;
+      std::vector<uint16_t>       d_free;
+      size_t d_cap;
+      size_t d_slab_reserve;
+    };
+
+  }
+}
+
+#endif /* SLAB_POOL_H */
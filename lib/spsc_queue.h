@@ -0,0 +1,88 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Lock-free single producer, single consumer queue of reusable slots.
+     *
+     *  Slots are default constructed once by reset() and never destroyed, the
+     *  producer fills back() and commits it with push(), the consumer reads
+     *  front() and hands it back with pop(). Swapping containers in and out of
+     *  the slots moves data across threads without allocation.
+     *  reset() must not run concurrently with either side.
+     */
+    template <typename T>
+    class spsc_queue
+    {
+     public:
+      explicit spsc_queue(size_t capacity = 0) { reset(capacity); }
+
+      // capacity is rounded up to a power of two
+      void reset(size_t capacity)
+      {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        d_slots.clear();
+        d_slots.resize(n);
+        d_mask = n - 1;
+        d_head.store(0, std::memory_order_relaxed);
+        d_tail.store(0, std::memory_order_relaxed);
+      }
+
+      // Producer side
+      bool full() const
+      {
+        return d_tail.load(std::memory_order_relaxed) - d_head.load(std::memory_order_acquire) > d_mask;
+      }
+      T &back() { return d_slots[d_tail.load(std::memory_order_relaxed) & d_mask]; }
+      void push() { d_tail.store(d_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+      // Consumer side
+      bool empty() const
+      {
+        return d_head.load(std::memory_order_relaxed) == d_tail.load(std::memory_order_acquire);
+      }
+      T &front() { return d_slots[d_head.load(std::memory_order_relaxed) & d_mask]; }
+      void pop() { d_head.store(d_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+      // Setup only, e.g. to reserve slot storage before the threads start
+      T &slot(size_t i) { return d_slots[i]; }
+      size_t capacity() const { return d_slots.size(); }
+
+     private:
+      std::vector<T>      d_slots;
+      size_t              d_mask;
+      std::atomic<size_t> d_head;     // next slot to read, written by the consumer only
+      std::atomic<size_t> d_tail;     // next slot to write, written by the producer only
+    };
+
+  }
+}
+
+#endif /* SPSC_QUEUE_H */
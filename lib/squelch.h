@@ -0,0 +1,105 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef SQUELCH_H
+#define SQUELCH_H
+
+#include <cmath>
+#include <volk/volk.h>
+#include <gnuradio/types.h>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Energy gate on raw IQ with a running noise floor estimate.
+     *
+     *  update() takes the mean power of a block and compares it with the
+     *  noise floor. The floor follows quiet blocks, quickly downwards and
+     *  slowly upwards, and ignores blocks above the margin, so bursts do not
+     *  pull it up. The gate is open while a block exceeds the floor by
+     *  margin_db and for SQUELCH_HANG blocks after that.
+     *  A margin of 0 dB (the default) disables the gate.
+     */
+    class power_squelch
+    {
+     public:
+      power_squelch()
+        : d_margin_db(0), d_ratio(1), d_floor(-1), d_hang_left(0),
+          d_open(true), d_reopened(false), d_gated(0)
+      {}
+
+      void set_margin(float margin_db)
+      {
+        d_margin_db = margin_db;
+        d_ratio = std::pow(10.0f, margin_db / 10);
+        d_open = true;
+      }
+
+      bool enabled() const { return d_margin_db > 0; }
+
+      // Returns whether the gate is open for the n samples at in
+      bool update(const gr_complex *in, uint32_t n)
+      {
+        float energy = 0;
+        volk_32f_x2_dot_prod_32f(&energy, (const float *) in, (const float *) in, 2*n);
+        float p = energy / n;
+
+        bool was_open = d_open;
+        if (d_floor < 0) d_floor = p;
+        if (p > d_floor * d_ratio)
+        {
+          d_hang_left = SQUELCH_HANG;
+          d_open = true;
+        }
+        else
+        {
+          d_floor += (p < d_floor ? 0.25f : 1.0f/256) * (p - d_floor);
+          d_open = d_hang_left > 0;
+          if (d_hang_left > 0) d_hang_left--;
+        }
+
+        if (!d_open) d_gated++;
+        d_reopened = d_open && !was_open;
+        return d_open;
+      }
+
+      // The last update() opened a closed gate, the caller may need to catch up on skipped blocks
+      bool reopened() const { return d_reopened; }
+
+      float noise_floor() const { return d_floor; }
+      uint64_t gated() const { return d_gated; }
+
+     private:
+      static const int SQUELCH_HANG = 2;
+
+      float    d_margin_db;
+      float    d_ratio;
+      float    d_floor;
+      int      d_hang_left;
+      bool     d_open;
+      bool     d_reopened;
+      uint64_t d_gated;
+    };
+
+  }
+}
+
+#endif /* SQUELCH_H */
@@ -0,0 +1,199 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <volk/volk.h>
+#include "stft.h"
+
+namespace gr {
+  namespace lora {
+
+    stft::stft(uint32_t num_samples, uint16_t fft_factor, uint32_t bin_size, int num_frames)
+      : d_num_samples(num_samples),
+        d_fft_factor(fft_factor),
+        d_fft_size(fft_factor*num_samples),
+        d_bin_size(bin_size),
+        d_fft(num_samples, fft_factor, num_frames),
+        d_frames(num_frames),
+        d_clock(0),
+        d_transforms(0),
+        d_derived(0),
+        d_requests(0)
+    {
+      for (auto & f : d_frames)
+      {
+        f.valid = false;
+        f.mag   = d_ws.alloc<float>(d_fft_size);
+        f.fold  = d_ws.alloc<float>(d_bin_size);
+      }
+      d_scaled = d_ws.alloc<float>(2*d_fft_size);
+    }
+
+    int
+    stft::add_reference(const std::vector<gr_complex> &chirp, const std::vector<float> &window)
+    {
+      gr_complex *ref = d_ws.alloc<gr_complex>(d_num_samples);
+      if (window.empty())
+      {
+        memcpy(ref, &chirp[0], d_num_samples*sizeof(gr_complex));
+      }
+      else
+      {
+        volk_32fc_32f_multiply_32fc(ref, &chirp[0], &window[0], d_num_samples);
+      }
+      d_refs.push_back(reference{ref, -1, std::vector<float>()});
+      return d_refs.size() - 1;
+    }
+
+    int
+    stft::add_cosine_sum_window(int ref, const std::vector<float> &coeffs)
+    {
+      assert(d_frames.size() >= 2);
+      assert(d_refs[ref].base < 0);
+      assert(!coeffs.empty() && (coeffs.size()-1)*d_fft_factor < d_fft_size);
+      d_refs.push_back(reference{nullptr, ref, coeffs});
+      return d_refs.size() - 1;
+    }
+
+    void
+    stft::apply_cosine_sum(gr_complex *out, const gr_complex *spec, const std::vector<float> &coeffs)
+    {
+      // Complex bins as interleaved floats, a shift by s bins is a shift by 2s floats
+      const uint32_t len = 2*d_fft_size;
+      const float *x = (const float *) spec;
+      float *y = (float *) out;
+
+      // y[m] = c0 x[m] + sum_k ck/2 (x[m - k f] + x[m + k f]), indices modulo fft_size
+      volk_32f_s32f_multiply_32f(y, x, coeffs[0], len);
+      for (size_t k = 1; k < coeffs.size(); k++)
+      {
+        uint32_t s = 2*k*d_fft_factor;
+        volk_32f_s32f_multiply_32f(d_scaled, x, coeffs[k]/2, len);
+        volk_32f_x2_add_32f(y + s, y + s, d_scaled, len - s);
+        volk_32f_x2_add_32f(y, y, d_scaled + len - s, s);
+        volk_32f_x2_add_32f(y, y, d_scaled + s, len - s);
+        volk_32f_x2_add_32f(y + len - s, y + len - s, d_scaled, s);
+      }
+    }
+
+    void
+    stft::reset()
+    {
+      for (auto & f : d_frames)
+      {
+        f.valid = false;
+      }
+    }
+
+    int
+    stft::lookup(uint64_t pos, const gr_complex *in, int ref)
+    {
+      d_requests++;
+      d_clock++;
+
+      for (int i = 0; i < (int)d_frames.size(); i++)
+      {
+        frame &f = d_frames[i];
+        if (f.valid && f.pos == pos && f.ref == ref)
+        {
+          f.last_use = d_clock;
+          return i;
+        }
+      }
+
+      // A windowed frame is derived from its base frame, which must survive the replacement
+      const reference &r = d_refs[ref];
+      int base = (r.base >= 0) ? lookup(pos, in, r.base) : -1;
+
+      int victim = (base == 0) ? 1 : 0;
+      for (int i = 0; i < (int)d_frames.size(); i++)
+      {
+        frame &f = d_frames[i];
+        if (i == base) continue;
+        if (!f.valid || (d_frames[victim].valid && f.last_use < d_frames[victim].last_use))
+        {
+          victim = i;
+        }
+      }
+
+      frame &f = d_frames[victim];
+      if (base < 0)
+      {
+        volk_32fc_x2_multiply_32fc(d_fft.get_inbuf(victim), in, r.chirp, d_num_samples);
+        d_fft.execute_slot(victim);
+        d_transforms++;
+      }
+      else
+      {
+        apply_cosine_sum(d_fft.get_outbuf(victim), d_fft.get_outbuf(base), r.coeffs);
+        d_derived++;
+      }
+
+      f.pos      = pos;
+      f.ref      = ref;
+      f.last_use = d_clock;
+      f.valid    = true;
+      f.has_mag  = false;
+      f.has_fold = false;
+      return victim;
+    }
+
+    const gr_complex *
+    stft::spectrum(uint64_t pos, const gr_complex *in, int ref)
+    {
+      return d_fft.get_outbuf(lookup(pos, in, ref));
+    }
+
+    const float *
+    stft::magnitude(uint64_t pos, const gr_complex *in, int ref)
+    {
+      int i = lookup(pos, in, ref);
+      frame &f = d_frames[i];
+      if (!f.has_mag)
+      {
+        volk_32fc_magnitude_32f(f.mag, d_fft.get_outbuf(i), d_fft_size);
+        f.has_mag = true;
+      }
+      return f.mag;
+    }
+
+    const float *
+    stft::folded(uint64_t pos, const gr_complex *in, int ref)
+    {
+      int i = lookup(pos, in, ref);
+      frame &f = d_frames[i];
+      if (!f.has_fold)
+      {
+        if (!f.has_mag)
+        {
+          volk_32fc_magnitude_32f(f.mag, d_fft.get_outbuf(i), d_fft_size);
+          f.has_mag = true;
+        }
+        volk_32f_x2_add_32f(f.fold, f.mag, &f.mag[d_fft_size-d_bin_size], d_bin_size);
+        f.has_fold = true;
+      }
+      return f.fold;
+    }
+
+  }
+}
@@ -0,0 +1,128 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef STFT_H
+#define STFT_H
+
+#include <vector>
+#include <gnuradio/types.h>
+#include "batch_fft.h"
+#include "workspace.h"
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Cached short-time spectra of dechirped symbol windows.
+     *
+     *  A frame is the fft_factor*N point spectrum of N input samples starting
+     *  at absolute stream offset pos, multiplied by one of the references
+     *  registered with add_reference() (a dechirping chirp, optionally
+     *  premultiplied by an analysis window). Frames are cached by (pos, ref)
+     *  in num_frames slots with least recently used replacement, so analyses
+     *  whose windows overlap or revisit the same samples with the same hop
+     *  only transform each window once. Magnitudes and the folded magnitude
+     *  |X[k]| + |X[k + fft_size - bin_size]| are derived on first request.
+     *
+     *  Pointers returned by spectrum(), magnitude() and folded() stay valid
+     *  until num_frames other frames have been requested.
+     */
+    class stft
+    {
+     public:
+      stft(uint32_t num_samples, uint16_t fft_factor, uint32_t bin_size, int num_frames);
+
+      /**
+       *  \brief  Register a reference, returns its id. Constructor-time only.
+       *
+       *  \param  chirp
+       *          num_samples samples multiplied onto each window
+       *  \param  window
+       *          analysis window of num_samples taps, or empty for none
+       */
+      int add_reference(const std::vector<gr_complex> &chirp,
+                        const std::vector<float> &window = std::vector<float>());
+
+      /**
+       *  \brief  Register reference ref windowed by a cosine-sum window, returns its id.
+       *          Constructor-time only.
+       *
+       *  w[n] = sum_k coeffs[k] cos(2 pi k n / num_samples). Multiplying by
+       *  cos(2 pi k n / num_samples) shifts the zero-padded spectrum by
+       *  k*fft_factor bins, so the frame is derived from the cached frame of
+       *  ref by a (2K-1)-tap circular convolution instead of another FFT.
+       *  Needs num_frames >= 2.
+       */
+      int add_cosine_sum_window(int ref, const std::vector<float> &coeffs);
+
+      const gr_complex *spectrum(uint64_t pos, const gr_complex *in, int ref);
+      const float *magnitude(uint64_t pos, const gr_complex *in, int ref);
+      const float *folded(uint64_t pos, const gr_complex *in, int ref);
+
+      // Drop every cached frame
+      void reset();
+
+      uint32_t fft_size() const { return d_fft_size; }
+      uint64_t transforms() const { return d_transforms; }
+      uint64_t derived() const { return d_derived; }
+      uint64_t requests() const { return d_requests; }
+
+     private:
+      struct frame {
+        uint64_t pos;
+        int      ref;
+        uint64_t last_use;
+        bool     valid;
+        bool     has_mag;
+        bool     has_fold;
+        float   *mag;
+        float   *fold;
+      };
+
+      struct reference {
+        gr_complex         *chirp;   // time domain reference, null for derived ones
+        int                 base;    // reference a cosine-sum window is applied to, -1 if none
+        std::vector<float>  coeffs;
+      };
+
+      int lookup(uint64_t pos, const gr_complex *in, int ref);
+      void apply_cosine_sum(gr_complex *out, const gr_complex *spec, const std::vector<float> &coeffs);
+
+      uint32_t d_num_samples;
+      uint16_t d_fft_factor;
+      uint32_t d_fft_size;
+      uint32_t d_bin_size;
+
+      batch_fft                 d_fft;   // one slot per cached frame
+      workspace                 d_ws;
+      std::vector<reference>    d_refs;
+      std::vector<frame>        d_frames;
+      float                    *d_scaled;   // scratch of apply_cosine_sum, 2*fft_size floats
+
+      uint64_t d_clock;
+      uint64_t d_transforms;
+      uint64_t d_derived;
+      uint64_t d_requests;
+    };
+
+  }
+}
+
+#endif /* STFT_H */
@@ -0,0 +1,215 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <iostream>
+#include <lora/lora.h>
+#include "stream_decoder.h"
+#include "utilities.h"
+
+namespace gr {
+  namespace lora {
+
+    stream_decoder::stream_decoder()
+      : d_fec(&fec_tables::get())
+    {
+      // the longest frame: explicit header, 255 byte payload and CRC
+      d_bytes.reserve(3 + 255 + 2);
+      reset(8, false, false, 4, false, 0);
+    }
+
+    void
+    stream_decoder::reset(uint8_t sf, bool header, bool ldr, uint8_t cr, bool crc, uint8_t payload_len)
+    {
+      d_sf          = sf;
+      d_header      = header;
+      d_ldr         = ldr;
+      d_cr          = cr;
+      d_crc         = crc;
+      d_payload_len = payload_len;
+
+      d_blocks      = 0;
+      d_frame_len   = 3*d_header + d_payload_len + 2*d_crc;
+      d_half        = false;
+      d_nibble      = 0;
+      d_checksum    = 0;
+      d_hdr.payload_len = payload_len;
+      d_hdr.cr          = cr;
+      d_hdr.crc         = crc;
+      d_hdr.valid       = true;
+      d_bytes.clear();
+
+      // The FEC tables only cover CR 4/5 to 4/8, in explicit header mode the header block brings its own
+      if (!d_header && (d_cr < 1 || d_cr > 4))
+      {
+        std::cerr << "Invalid coding rate " << int(d_cr) << ", packet not decoded." << std::endl;
+        d_hdr.valid = false;
+      }
+    }
+
+    bool
+    stream_decoder::push_block(const uint16_t *symbols)
+    {
+      if (!d_hdr.valid)
+      {
+        return false;
+      }
+
+      const bool     header_block  = d_blocks == 0;
+      // Forward interleaver: ppm codewords of 4+rdd bits in, 4+rdd symbols of ppm bits out
+      const uint32_t ppm           = (header_block || d_ldr) ? d_sf - 2 : d_sf;
+      const uint32_t rdd           = header_block ? 4 : d_cr;
+      const uint32_t bits_per_word = rdd + 4;
+
+      uint8_t codewords[12] = {0};
+      uint8_t header_nibbles[5];
+      for (uint32_t i = 0; i < bits_per_word; i++)
+      {
+        // symbols at sf-2 bits are sent 4 bins apart, full rate symbols are offset by one bin
+        uint16_t v = (header_block || d_ldr) ? symbols[i] / 4 : gr::lora::pmod(symbols[i] - 1, 1 << d_sf);
+        v = (v >> 1) ^ v;
+
+        const uint32_t word = gr::lora::rotl(v, i, ppm);
+        for (uint32_t x = 0; x < ppm; x++)
+        {
+          codewords[x] |= ((word >> x) & 1) << i;
+        }
+      }
+      d_blocks++;
+
+      // CR 4/7 and 4/8 correct a single bit error, 4/5 and 4/6 only detect it
+      const uint8_t *fec_decode = d_fec->decode[rdd - 1];
+      for (uint32_t x = 0; x < ppm; x++)
+      {
+        uint8_t nibble = fec_decode[codewords[x]];
+
+        if (header_block && d_header && x < 5)
+        {
+          header_nibbles[x] = nibble;
+          if (x < 4)
+          {
+            continue;
+          }
+
+          d_hdr = parse_header_nibbles(header_nibbles);
+          if (!d_hdr.valid)
+          {
+            return false;
+          }
+          d_cr          = d_hdr.cr;
+          d_crc         = d_hdr.crc;
+          d_payload_len = d_hdr.payload_len;
+          d_frame_len   = 3 + d_payload_len + 2*d_crc;
+
+          // the header has 2.5 bytes, zero-padded to 3
+          for (int i = 0; i < 5; i++)
+          {
+            push_nibble(header_nibbles[i]);
+          }
+          push_nibble(0);
+          continue;
+        }
+
+        push_nibble(nibble);
+      }
+
+      return true;
+    }
+
+    void
+    stream_decoder::push_nibble(uint8_t nibble)
+    {
+      if (!d_half)
+      {
+        d_nibble = nibble;
+        d_half   = true;
+        return;
+      }
+      d_half = false;
+
+      // header bytes are sent high nibble first, payload bytes low nibble first
+      if (d_header && d_bytes.size() < 3)
+      {
+        push_byte((d_nibble << 4) | nibble);
+      }
+      else
+      {
+        push_byte((nibble << 4) | d_nibble);
+      }
+    }
+
+    void
+    stream_decoder::push_byte(uint8_t byte)
+    {
+      if (d_bytes.size() >= d_frame_len)
+      {
+        return;     // padding of the last block
+      }
+
+      const int j = (int)d_bytes.size() - 3*d_header;
+      if (j >= 0 && j < d_payload_len)
+      {
+        if (j < whitening_sequence_length)
+        {
+          byte ^= whitening_sequence[j];
+        }
+
+        // data_checksum(): CRC over all but the last two bytes, which are XORed in
+        if (j < d_payload_len - 2)
+        {
+          uint8_t new_byte = byte;
+          for (int i = 0; i < 8; i++)
+          {
+            if (((d_checksum & 0x8000) >> 8) ^ (new_byte & 0x80))
+            {
+              d_checksum = (d_checksum << 1) ^ 0x1021;
+            }
+            else
+            {
+              d_checksum = (d_checksum << 1);
+            }
+            new_byte <<= 1;
+          }
+        }
+        else if (j == d_payload_len - 2)
+        {
+          d_checksum ^= byte << 8;
+        }
+        else
+        {
+          d_checksum ^= byte;
+        }
+      }
+
+      d_bytes.push_back(byte);
+    }
+
+    bool
+    stream_decoder::crc_ok() const
+    {
+      if (!d_crc || !done())
+      {
+        return false;
+      }
+      const size_t offset = 3*d_header + d_payload_len;
+      return (d_bytes[offset] | (d_bytes[offset+1] << 8)) == d_checksum;
+    }
+
+  }
+}
@@ -0,0 +1,98 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef STREAM_DECODER_H
+#define STREAM_DECODER_H
+
+#include <cstdint>
+#include <vector>
+#include <lora/api.h>
+#include "header_codec.h"
+#include "fec.h"
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Decodes a LoRa packet one interleaver block at a time.
+     *
+     *  The first block is the 8 symbol header block, sent at sf-2 bits per
+     *  symbol and CR 4/8, every following block holds 4+cr symbols. Symbols
+     *  are taken as lora::demod emits them. Each byte is dewhitened and run
+     *  through the CRC as soon as its nibbles are decoded, so the frame is
+     *  complete once the block holding its last byte is pushed.
+     *
+     *  bytes() is laid out like the output of lora::decode: the 3 header
+     *  bytes in explicit header mode, the payload, then the 2 CRC bytes.
+     *  Exported for the C++ qa tests.
+     */
+    class LORA_API stream_decoder
+    {
+     public:
+      stream_decoder();
+
+      /**
+       *  \brief  Start a packet. In explicit header mode cr, crc and
+       *          payload_len are replaced by those of the header block.
+       *          In implicit header mode a cr outside 1..4 invalidates
+       *          the packet, push_block() then decodes nothing.
+       */
+      void reset(uint8_t sf, bool header, bool ldr, uint8_t cr, bool crc, uint8_t payload_len);
+
+      /**
+       *  \brief  Decode the next complete block of block_len() symbols.
+       *          Returns false when the header block holds an invalid header
+       *          or the packet was invalidated in reset().
+       */
+      bool push_block(const uint16_t *symbols);
+
+      uint32_t block_len() const { return d_blocks == 0 ? 8 : 4 + d_cr; }
+      bool done() const { return d_blocks > 0 && d_bytes.size() >= d_frame_len; }
+      bool crc_ok() const;
+
+      const lora_header &header() const { return d_hdr; }
+      const std::vector<uint8_t> &bytes() const { return d_bytes; }
+
+     private:
+      void push_nibble(uint8_t nibble);
+      void push_byte(uint8_t byte);
+
+      uint8_t  d_sf;
+      bool     d_header;
+      bool     d_ldr;
+      uint8_t  d_cr;
+      bool     d_crc;
+      uint8_t  d_payload_len;
+
+      const fec_tables *d_fec;
+
+      uint32_t d_blocks;
+      uint32_t d_frame_len;         // header, payload and CRC bytes
+      bool     d_half;              // a nibble is waiting for its pair
+      uint8_t  d_nibble;
+      uint16_t d_checksum;          // running data_checksum() of the payload
+      lora_header d_hdr;
+      std::vector<uint8_t> d_bytes;
+    };
+
+  }
+}
+
+#endif /* STREAM_DECODER_H */
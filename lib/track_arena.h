@@ -0,0 +1,178 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef TRACK_ARENA_H
+#define TRACK_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Non-owning view of one peak track, index 0 is the oldest peak.
+     *
+     *  Only valid until the owning track_arena is modified.
+     */
+    class track_view
+    {
+     public:
+      track_view(const uint32_t *ts, const uint32_t *bin, const float *h, const float *h_single,
+                 uint32_t head, uint32_t len, uint32_t mask)
+        : d_ts(ts), d_bin(bin), d_h(h), d_h_single(h_single), d_head(head), d_len(len), d_mask(mask)
+      {}
+
+      uint32_t size() const { return d_len; }
+      bool empty() const { return d_len == 0; }
+
+      uint32_t ts(uint32_t i) const { return d_ts[at(i)]; }
+      uint32_t bin(uint32_t i) const { return d_bin[at(i)]; }
+      float h(uint32_t i) const { return d_h[at(i)]; }
+      float h_single(uint32_t i) const { return d_h_single[at(i)]; }
+
+      // Peaks [start, end) of this track
+      track_view slice(uint32_t start, uint32_t end) const
+      {
+        return track_view(d_ts, d_bin, d_h, d_h_single, (d_head + start) & d_mask, end - start, d_mask);
+      }
+
+     private:
+      uint32_t at(uint32_t i) const { return (d_head + i) & d_mask; }
+
+      const uint32_t *d_ts;
+      const uint32_t *d_bin;
+      const float    *d_h;
+      const float    *d_h_single;
+      uint32_t d_head;
+      uint32_t d_len;
+      uint32_t d_mask;
+    };
+
+    /**
+     *  \brief  Peak tracks stored as structure-of-arrays columns (ts, bin, h, h_single).
+     *
+     *  Every track id owns a fixed-capacity ring slice of the columns; a full
+     *  track drops its oldest peak. Ids are handed out like slab_pool: created
+     *  on demand up to a cap and recycled without touching the allocator. The
+     *  columns are reserved for the cap up front, so views stay valid while
+     *  the arena grows.
+     */
+    class track_arena
+    {
+     public:
+      track_arena() : d_cap(0), d_track_len(0), d_shift(0) {}
+
+      // track_len is rounded up to a power of two
+      void reset(size_t initial, size_t cap, uint32_t track_len)
+      {
+        d_shift = 0;
+        while ((1u << d_shift) < track_len) d_shift++;
+        d_track_len = 1u << d_shift;
+        d_cap = cap;
+
+        d_ts.clear();       d_ts.reserve(cap << d_shift);
+        d_bin.clear();      d_bin.reserve(cap << d_shift);
+        d_h.clear();        d_h.reserve(cap << d_shift);
+        d_h_single.clear(); d_h_single.reserve(cap << d_shift);
+        d_head.clear();     d_head.reserve(cap);
+        d_len.clear();      d_len.reserve(cap);
+        d_free.clear();     d_free.reserve(cap);
+        grow(initial < cap ? initial : cap);
+      }
+
+      bool acquire(uint16_t &id)
+      {
+        if (d_free.empty())
+        {
+          if (d_head.size() >= d_cap) return false;
+          grow(d_head.empty() ? 1 : d_head.size());
+        }
+        id = d_free.back();
+        d_free.pop_back();
+        return true;
+      }
+
+      void release(uint16_t id)
+      {
+        d_head[id] = 0;
+        d_len[id] = 0;
+        d_free.push_back(id);
+      }
+
+      void push_back(uint16_t id, uint32_t ts, uint32_t bin, float h, float h_single)
+      {
+        uint32_t mask = d_track_len - 1;
+        uint32_t i = ((uint32_t)id << d_shift) + ((d_head[id] + d_len[id]) & mask);
+        d_ts[i] = ts;
+        d_bin[i] = bin;
+        d_h[i] = h;
+        d_h_single[i] = h_single;
+        if (d_len[id] < d_track_len) d_len[id]++;
+        else d_head[id] = (d_head[id] + 1) & mask;
+      }
+
+      track_view view(uint16_t id) const
+      {
+        size_t base = (size_t)id << d_shift;
+        return track_view(&d_ts[base], &d_bin[base], &d_h[base], &d_h_single[base],
+                          d_head[id], d_len[id], d_track_len - 1);
+      }
+
+      uint32_t track_size(uint16_t id) const { return d_len[id]; }
+      uint32_t track_len() const { return d_track_len; }
+      size_t size() const { return d_head.size(); }         // tracks created so far
+      size_t in_use() const { return d_head.size() - d_free.size(); }
+      size_t cap() const { return d_cap; }
+
+     private:
+      void grow(size_t n)
+      {
+        size_t end = d_head.size() + n;
+        if (end > d_cap) end = d_cap;
+        for (size_t i = end; i-- > d_head.size(); )
+        {
+          d_free.push_back(i);
+        }
+        d_ts.resize(end << d_shift);
+        d_bin.resize(end << d_shift);
+        d_h.resize(end << d_shift);
+        d_h_single.resize(end << d_shift);
+        d_head.resize(end, 0);
+        d_len.resize(end, 0);
+      }
+
+      std::vector<uint32_t> d_ts;
+      std::vector<uint32_t> d_bin;
+      std::vector<float>    d_h;
+      std::vector<float>    d_h_single;
+      std::vector<uint32_t> d_head;   // ring start of each track
+      std::vector<uint32_t> d_len;    // number of peaks in each track
+      std::vector<uint16_t> d_free;
+      size_t   d_cap;
+      uint32_t d_track_len;
+      uint32_t d_shift;
+    };
+
+  }
+}
+
+#endif /* TRACK_ARENA_H */
@@ -71,6 +71,14 @@ namespace gr {
       return ((bits << count) & len_mask) | (bits >> (size - count));
     }
 
+    /**
+     *  \brief  Number of symbols of the longest possible packet (255 byte payload, CR 4/8, CRC, explicit header)
+     */
+    inline uint32_t max_packet_symbol_len(uint8_t sf, bool ldr)
+    {
+      return 8 + 8*(uint32_t)std::ceil((2.0*255-sf+7+4)/(sf-2*ldr));
+    }
+
     inline uint16_t data_checksum(const uint8_t *data, int length) {
       uint16_t crc = 0;
       for (int j = 0; j < length - 2; j++)
@@ -157,25 +165,6 @@ namespace gr {
       *k = numerator / denominator;
       *b = avg_y - *k * avg_x;
     }
-
-    inline uint32_t argmax_32f(float *res, float *p_max_val, uint32_t len)
-    {
-      float mag = abs(res[0]);
-      uint32_t max_idx = 0;
-
-      *p_max_val = mag;
-      for (int i = 1; i < len; i++)
-      {
-        mag = abs(res[i]);
-        if (mag > *p_max_val)
-        {
-          max_idx = i;
-          *p_max_val = mag;
-        }
-      }
-
-      return max_idx;
-    }
   }
 }
 
@@ -114,19 +114,22 @@ namespace gr {
       d_num_samples = d_p*d_num_symbols;
       d_bin_size = d_fft_size_factor*d_num_symbols;
       d_fft_size = d_fft_size_factor*d_num_samples;
-      d_fft = new fft::fft_complex(d_fft_size, true, 1);
+      // Up to four windows per step, half of them revisited by the next step
+      d_stft = new stft(d_num_samples, d_fft_size_factor, d_bin_size, 8);
       d_overlaps = OVERLAP_DEFAULT;
       d_offset = 0;
       d_preamble_drift_max = d_fft_size_factor * (d_ldr ? 2 : 1);
 
-      d_window = fft::window::build(fft::window::WIN_KAISER, d_num_samples, d_beta);
+      d_chirps   = gr::lora::get_chirp_tables(d_sf, d_p, d_beta);
+      d_ref_up   = d_stft->add_reference(d_chirps->downchirp);
+      d_ref_down = d_stft->add_reference(d_chirps->upchirp);
 
-      // Create local chirp tables.  Each table is 2 chirps long to allow memcpying from arbitrary offsets.
-      for (int i = 0; i < d_num_samples; i++) {
-        double phase = M_PI/d_p*(i-i*i/(float)d_num_samples);
-        d_downchirp.push_back(gr_complex(std::polar(1.0, phase)));
-        d_upchirp.push_back(gr_complex(std::polar(1.0, -phase)));
-      }
+      d_fft_add = d_ws.alloc<float>(d_bin_size);
+      d_ws.seal();
+
+      d_argmax_history.reset(WEAK_REQUIRED_PREAMBLE_CHIRPS);
+      d_symbols.reset(d_sym_num + 1);
+      d_compensated_symbols.reserve(d_symbols.capacity());
 
       set_history(WEAK_DEMOD_BUFFER_SIZE*d_num_samples);  // Sync is 2.25 chirp periods long
     }
@@ -136,6 +139,13 @@ namespace gr {
      */
     weak_demod_impl::~weak_demod_impl()
     {
+      #if DEBUG >= DEBUG_INFO
+        std::cout << "workspace buffers allocated after construction: " << d_ws.late_allocations() << std::endl;
+        if (heap_counter::enabled()) std::cout << "heap allocations in general_work: " << d_heap.count() << std::endl;
+        std::cout << "symbols skipped by the squelch: " << d_squelch.gated() << std::endl;
+        std::cout << "symbol FFTs: " << d_stft->transforms() << " of " << d_stft->requests() << " spectra" << std::endl;
+      #endif
+      delete d_stft;
     }
 
     void
@@ -143,59 +153,39 @@ namespace gr {
     {
     }
 
-    void
-    weak_demod_impl::dechirp(bool is_up,
-                        const gr_complex *in,
-                        gr_complex *block,
-                        float *fft_mag,
-                        float *fft_add)
+    const float *
+    weak_demod_impl::dechirp(bool is_up, const gr_complex *in)
     {
-      if (is_up) {
-        volk_32fc_x2_multiply_32fc(block, in, &d_downchirp[0], d_num_samples);
-      }
-      else {
-        volk_32fc_x2_multiply_32fc(block, in, &d_upchirp[0], d_num_samples);
-      }
-
-      memset(d_fft->get_inbuf(),            0, d_fft_size*sizeof(gr_complex));
-      memcpy(d_fft->get_inbuf(), &block[0], d_num_samples*sizeof(gr_complex));
-      d_fft->execute();
-      volk_32fc_magnitude_32f(fft_mag, d_fft->get_outbuf(), d_fft_size);
-      volk_32f_x2_add_32f(fft_add, fft_mag, &fft_mag[d_fft_size-d_bin_size], d_bin_size);
+      // Windows are revisited by the next step, d_stft only transforms new ones
+      const float *fft_add = d_stft->folded(d_in0_pos + (in - d_in0), in, is_up ? d_ref_up : d_ref_down);
       #if DEBUG >= DEBUG_VERBOSE
         float max_val = 0;
         uint32_t max_idx = gr::lora::argmax_32f(fft_add, &max_val, d_bin_size);
         std::cout << "[dechirp] max_idx: " << max_idx << ", max_val: " << max_val << std::endl;
       #endif
+      return fft_add;
     }
 
     uint32_t
-    weak_demod_impl::search_fft_peak(bool is_up,
-                                const gr_complex *in,
-                                gr_complex *block1,
-                                gr_complex *block2,
-                                float *fft_mag1,
-                                float *fft_mag2,
-                                float *fft_add1,
-                                float *fft_add2,
-                                float *p_max_val)
+    weak_demod_impl::search_fft_peak(bool is_up, const gr_complex *in, float *p_max_val)
     {
       // Dechirp the incoming signal
-      dechirp(is_up, in, block1, fft_mag1, fft_add1);
-      dechirp(is_up, &in[d_num_samples], block2, fft_mag2, fft_add2);
+      const float *fft_add1 = dechirp(is_up, in);
+      const float *fft_add2 = dechirp(is_up, &in[d_num_samples]);
 
       if (*p_max_val == 999) {
         f_fft.write((const char*)&fft_add1[0], d_bin_size*sizeof(float));
         f_down.write((const char*)&fft_add2[0], d_bin_size*sizeof(float));
       }
 
-      volk_32f_x2_add_32f(fft_add1, fft_add1, fft_add2, d_bin_size);
-      return gr::lora::argmax_32f(fft_add1, p_max_val, d_bin_size);
+      volk_32f_x2_add_32f(d_fft_add, fft_add1, fft_add2, d_bin_size);
+      return gr::lora::argmax_32f(d_fft_add, p_max_val, d_bin_size);
     }
 
     void
     weak_demod_impl::dynamic_compensation(std::vector<uint16_t>& compensated_symbols)
     {
+      compensated_symbols.clear();
       float modulus   = d_ldr ? 4.0 : 1.0;
       float bin_drift = 0;
       float bin_comp  = 0;
@@ -216,6 +206,12 @@ namespace gr {
       }
     }
 
+    void
+    weak_demod_impl::set_squelch(float margin_db)
+    {
+      d_squelch.set_margin(margin_db);
+    }
+
     void
     weak_demod_impl::forecast (int noutput_items, gr_vector_int &ninput_items_required)
     {
@@ -228,6 +224,7 @@ namespace gr {
                        gr_vector_const_void_star &input_items,
                        gr_vector_void_star &output_items)
     {
+      heap_counter::scope heap_scope(d_heap);
       if (ninput_items[0] < WEAK_DEMOD_BUFFER_SIZE*d_num_samples) return 0;
       const gr_complex *in0 = (const gr_complex *) input_items[0];
       const gr_complex *in  = &in0[WEAK_DEMOD_HISTORY*d_num_samples];
@@ -237,25 +234,31 @@ namespace gr {
       uint32_t max_idx = 0;
       float max_val = 0;
 
-      gr_complex *block1 = (gr_complex *)volk_malloc(d_fft_size*sizeof(gr_complex), volk_get_alignment());
-      gr_complex *block2 = (gr_complex *)volk_malloc(d_fft_size*sizeof(gr_complex), volk_get_alignment());
-      float *fft_mag1 = (float*)volk_malloc(d_fft_size*sizeof(float), volk_get_alignment());
-      float *fft_mag2 = (float*)volk_malloc(d_fft_size*sizeof(float), volk_get_alignment());
-      float *fft_add1 = (float*)volk_malloc(d_bin_size*sizeof(float), volk_get_alignment());
-      float *fft_add2 = (float*)volk_malloc(d_bin_size*sizeof(float), volk_get_alignment());
-
-      if (block1 == NULL ||
-          block2 == NULL ||
-          fft_mag1 == NULL ||
-          fft_mag2 == NULL ||
-          fft_add1 == NULL ||
-          fft_add2 == NULL
-      )
+      d_in0     = in0;
+      d_in0_pos = nitems_read(0) - (history() - 1);
+
+      // While searching for a preamble, the two symbols searched below must clear the squelch
+      if (d_squelch.enabled() && (d_state == WS_PREFILL || d_state == WS_DETECT_PREAMBLE))
       {
-        std::cerr << "Unable to allocate processing buffer!" << std::endl;
+        if (!d_squelch.update(in, 2*d_num_samples))
+        {
+          consume_each(d_num_samples);
+          return noutput_items;
+        }
+        if (d_squelch.reopened())
+        {
+          // The symbols skipped right before the gate opened are still in the history, their
+          // peaks let a preamble that started under the gate be detected on time
+          d_argmax_history.clear();
+          for (int i = WEAK_REQUIRED_PREAMBLE_CHIRPS-1; i > 0; i--)
+          {
+            max_idx = search_fft_peak(true, &in[-i*(int)d_num_samples], &max_val);
+            if (max_val > 0) d_argmax_history.push_back(max_idx);
+          }
+        }
       }
 
-      max_idx = search_fft_peak(true, in, block1, block2, fft_mag1, fft_mag2, fft_add1, fft_add2, &max_val);
+      max_idx = search_fft_peak(true, in, &max_val);
 
       uint32_t num_consumed = d_num_samples;
       static uint32_t sym_cnt = 0;
@@ -266,12 +269,8 @@ namespace gr {
       #endif
 
       if (max_val > 0) {
-        d_argmax_history.insert(d_argmax_history.begin(), max_idx);
-
-        if (d_argmax_history.size() > WEAK_REQUIRED_PREAMBLE_CHIRPS)
-        {
-          d_argmax_history.pop_back();
-        }
+        // Keeps the last WEAK_REQUIRED_PREAMBLE_CHIRPS peaks, recent(0) is the newest
+        d_argmax_history.push_back(max_idx);
       }
 
       switch (d_state) {
@@ -311,14 +310,14 @@ namespace gr {
 
       case WS_DETECT_PREAMBLE:
       {
-        d_preamble_idx = d_argmax_history[0];
+        d_preamble_idx = d_argmax_history.recent(0);
 
 
         // Check for discontinuities that exceed some tolerance
         preamble_found = true;
         for (int i = 1; i < WEAK_REQUIRED_PREAMBLE_CHIRPS; i++)
         {
-          uint32_t dis = gr::lora::pmod(int(d_preamble_idx) - int(d_argmax_history[i]), d_bin_size);
+          uint32_t dis = gr::lora::pmod(int(d_preamble_idx) - int(d_argmax_history.recent(i)), d_bin_size);
           if (dis > d_preamble_drift_max && dis < d_bin_size-d_preamble_drift_max)
           {
             preamble_found = false;
@@ -330,8 +329,8 @@ namespace gr {
         {
           #if DEBUG >= DEBUG_VERBOSE
             std::cout << "PREAMBLE: ";
-            for (auto idx: d_argmax_history) {
-              std::cout << idx << ",";
+            for (size_t i = 0; i < d_argmax_history.size(); i++) {
+              std::cout << d_argmax_history.recent(i) << ",";
             }
             std::cout << std::endl;
           #endif
@@ -364,9 +363,9 @@ namespace gr {
         float max_val_down[2] = {0};
         uint32_t max_idx_up[2] = {max_idx, 0};
         uint32_t max_idx_down[2] = {0};
-        max_idx_up[1] = search_fft_peak(true, &in[d_num_samples], block1, block2, fft_mag1, fft_mag2, fft_add1, fft_add2, &max_val_up[1]);
-        max_idx_down[0] = search_fft_peak(false, in, block1, block2, fft_mag1, fft_mag2, fft_add1, fft_add2, &max_val_down[0]);
-        max_idx_down[1] = search_fft_peak(false, &in[d_num_samples], block1, block2, fft_mag1, fft_mag2, fft_add1, fft_add2, &max_val_down[1]);
+        max_idx_up[1] = search_fft_peak(true, &in[d_num_samples], &max_val_up[1]);
+        max_idx_down[0] = search_fft_peak(false, in, &max_val_down[0]);
+        max_idx_down[1] = search_fft_peak(false, &in[d_num_samples], &max_val_down[1]);
 
         #if DEBUG >= DEBUG_VERBOSE
           std::cout << "[SYNC] max_idx_up[0]: " << max_idx_up[0] << ", max_idx_up[1]: " << max_idx_up[1] << std::endl;
@@ -381,7 +380,7 @@ namespace gr {
             num_consumed = (int)round((2.25+i)*d_num_samples + d_p*offset/2.0/d_fft_size_factor);
             // refine CFO
             float max_val_cfo = 999;
-            d_cfo = (float) search_fft_peak(true, &in0[(int)round((WEAK_DEMOD_HISTORY-6.25)*d_num_samples + num_consumed)], block1, block2, fft_mag1, fft_mag2, fft_add1, fft_add2, &max_val_cfo);
+            d_cfo = (float) search_fft_peak(true, &in0[(int)round((WEAK_DEMOD_HISTORY-6.25)*d_num_samples + num_consumed)], &max_val_cfo);
 
             d_state = WS_READ_PAYLOAD;
 
@@ -442,9 +441,8 @@ namespace gr {
       // Emit a PDU to the decoder
       case WS_OUT:
       {
-        std::vector<uint16_t> compensated_symbols;
-        dynamic_compensation(compensated_symbols);
-        pmt::pmt_t output = pmt::init_u16vector(compensated_symbols.size(), compensated_symbols);
+        dynamic_compensation(d_compensated_symbols);
+        pmt::pmt_t output = pmt::init_u16vector(d_compensated_symbols.size(), d_compensated_symbols);
         pmt::pmt_t dict = pmt::make_dict();
         dict = pmt::dict_add(dict, pmt::intern("id"), pmt::intern("packet"));
         pmt::pmt_t msg_pair = pmt::cons(dict, output);
@@ -455,7 +453,7 @@ namespace gr {
           std::cout << "Next state: S_RESET" << std::endl;
           std::cout << "d_symbols size: " << d_symbols.size() << std::endl;
           std::cout << "compensated_symbols: ";
-          for (auto i: compensated_symbols) {
+          for (auto i: d_compensated_symbols) {
             std::cout << i << " ";
           }
           std::cout << std::endl;
@@ -471,13 +469,6 @@ namespace gr {
       consume_each (num_consumed);
       if (idx_cnt > 0) idx_cnt += num_consumed;
 
-      volk_free(block1);
-      volk_free(block2);
-      volk_free(fft_mag1);
-      volk_free(fft_mag2);
-      volk_free(fft_add1);
-      volk_free(fft_add2);
-
       return noutput_items;
     }
 
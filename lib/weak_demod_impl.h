@@ -33,6 +33,13 @@
 #include <volk/volk.h>
 #include <lora/weak_demod.h>
 #include "utilities.h"
+#include "peak_search.h"
+#include "stft.h"
+#include "dsp_registry.h"
+#include "workspace.h"
+#include "heap_counter.h"
+#include "squelch.h"
+#include "ring_buffer.h"
 
 namespace gr {
   namespace lora {
@@ -70,7 +77,7 @@ namespace gr {
 
       uint32_t d_preamble_idx;
       uint16_t d_sfd_idx;
-      std::vector<uint32_t> d_argmax_history;
+      fixed_ring<uint32_t>  d_argmax_history;
       std::vector<uint16_t> d_sfd_history;
       uint16_t d_sync_recovery_counter;
 
@@ -78,14 +85,28 @@ namespace gr {
       uint16_t d_peak_search_algorithm;
       uint16_t d_peak_search_phase_k;
 
-      fft::fft_complex   *d_fft;
-      std::vector<float> d_window;
+      stft               *d_stft;
+      int                d_ref_up;     // dechirps upchirps
+      int                d_ref_down;   // dechirps downchirps
       float              d_beta;
 
-      std::vector<gr_complex> d_upchirp;
-      std::vector<gr_complex> d_downchirp;
+      // Chirp tables and Kaiser window, shared with the other blocks using them
+      std::shared_ptr<const chirp_tables> d_chirps;
 
-      std::vector<float> d_symbols;
+      fixed_ring<float>     d_symbols;
+      std::vector<uint16_t> d_compensated_symbols;
+
+      // Processing buffers, sized once in the constructor
+      workspace   d_ws;
+      heap_counter d_heap;
+      float      *d_fft_add;
+
+      // Input window of the running work call, used to key d_stft by stream offset
+      const gr_complex *d_in0;
+      uint64_t          d_in0_pos;
+
+      // Energy gate in front of the preamble search
+      power_squelch d_squelch;
 
       std::ofstream f_raw, f_up_windowless, f_up, f_down, f_fft;
 
@@ -105,22 +126,11 @@ namespace gr {
       ~weak_demod_impl();
 
       void parse_header(pmt::pmt_t dict);
+      void set_squelch(float margin_db);
+
+      const float *dechirp(bool is_up, const gr_complex *in);
 
-      void dechirp(bool is_up,
-                        const gr_complex *in,
-                        gr_complex *up_block,
-                        float *fft_mag,
-                        float *fft_add);
-
-      uint32_t search_fft_peak(bool is_up,
-                      const gr_complex *in,
-                      gr_complex *block1,
-                      gr_complex *block2,
-                      float *fft_mag1,
-                      float *fft_mag2,
-                      float *fft_add1,
-                      float *fft_add2,
-                      float *p_max_val);
+      uint32_t search_fft_peak(bool is_up, const gr_complex *in, float *p_max_val);
       
       void dynamic_compensation(std::vector<uint16_t>& compensated_symbols);
 
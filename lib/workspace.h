@@ -0,0 +1,82 @@
+/* -*- c++ -*- */
+/*
+ * Copyright 2021 jkadbear.
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 51 Franklin Street,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <volk/volk.h>
+
+namespace gr {
+  namespace lora {
+
+    /**
+     *  \brief  Aligned scratch buffers owned by one block instance.
+     *
+     *  All buffers are requested in the block constructor, which then calls
+     *  seal(). late_allocations() counts workspace requests made after that.
+     *  It only sees this class; heap allocations elsewhere in the work
+     *  functions are counted by heap_counter.
+     */
+    class workspace
+    {
+     public:
+      workspace() : d_sealed(false), d_late_allocs(0) {}
+
+      ~workspace()
+      {
+        for (auto p : d_buffers) volk_free(p);
+      }
+
+      template <typename T>
+      T *alloc(size_t n)
+      {
+        if (d_sealed) d_late_allocs++;
+
+        T *p = (T *)volk_malloc(n*sizeof(T), volk_get_alignment());
+        if (p == NULL)
+        {
+          std::cerr << "Unable to allocate processing buffer!" << std::endl;
+          return NULL;
+        }
+        memset((void *)p, 0, n*sizeof(T));
+        d_buffers.push_back(p);
+        return p;
+      }
+
+      void seal() { d_sealed = true; }
+
+      uint64_t late_allocations() const { return d_late_allocs; }
+
+     private:
+      workspace(const workspace &);
+      workspace &operator=(const workspace &);
+
+      std::vector<void *> d_buffers;
+      bool                d_sealed;
+      uint64_t            d_late_allocs;
+    };
+
+  }
+}
+
+#endif /* WORKSPACE_H */
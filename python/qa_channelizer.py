@@ -0,0 +1,65 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2021 jkadbear.
+#
+# This is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3, or (at your option)
+# any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software; see the file COPYING.  If not, write to
+# the Free Software Foundation, Inc., 51 Franklin Street,
+# Boston, MA 02110-1301, USA.
+#
+
+import cmath
+import math
+
+from gnuradio import gr, gr_unittest
+from gnuradio import blocks
+import lora_swig as lora
+
+class qa_channelizer(gr_unittest.TestCase):
+
+    def setUp(self):
+        self.tb = gr.top_block()
+
+    def tearDown(self):
+        self.tb = None
+
+    def channel_powers(self, num_channels, freq):
+        # mean power of every output for a unit tone at freq (in channel spacings)
+        nout = 400
+        skip = 50       # filter transient
+        tone = [cmath.exp(2j*math.pi*freq*n/num_channels) for n in range(nout*num_channels)]
+        src = blocks.vector_source_c(tone)
+        chan = lora.channelizer(num_channels, 16, 6.76)
+        sinks = [blocks.vector_sink_c() for c in range(num_channels)]
+        self.tb.connect(src, chan)
+        for c in range(num_channels):
+            self.tb.connect((chan, c), sinks[c])
+        self.tb.run()
+        self.tb = gr.top_block()
+        return [sum(abs(y)**2 for y in s.data()[skip:]) / (nout - skip) for s in sinks]
+
+    def test_001_tone_sweep(self):
+        # a tone anywhere in a 125 kHz LoRa channel of 200 kHz spacing stays in its output
+        num_channels = 8
+        for k in range(num_channels):
+            for offset in (-0.3, 0.0, 0.3):
+                p = self.channel_powers(num_channels, k + offset)
+                self.assertAlmostEqual(10*math.log10(p[k]), 0.0, delta=0.5)
+                for c in range(num_channels):
+                    if c != k:
+                        self.assertLess(10*math.log10(p[c] / p[k] + 1e-20), -60)
+
+
+if __name__ == '__main__':
+    gr_unittest.run(qa_channelizer)
@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2021 jkadbear.
+#
+# This is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3, or (at your option)
+# any later version.
+#
+# This software is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this software; see the file COPYING.  If not, write to
+# the Free Software Foundation, Inc., 51 Franklin Street,
+# Boston, MA 02110-1301, USA.
+#
+
+import random
+import time
+
+import pmt
+from gnuradio import gr, gr_unittest
+from gnuradio import blocks
+import lora_swig as lora
+
+MOD_OUTPUT_BURST = 1
+
+class qa_multi_sf_demod(gr_unittest.TestCase):
+
+    def setUp(self):
+        self.tb = gr.top_block()
+
+    def tearDown(self):
+        self.tb = None
+
+    def run_until(self, tb, done, timeout=10.0):
+        # lora.mod and the message outputs never finish on their own
+        tb.start()
+        deadline = time.time() + timeout
+        while not done() and time.time() < deadline:
+            time.sleep(0.05)
+        tb.stop()
+        tb.wait()
+
+    def modulate(self, sf, symbols):
+        # one burst of lora.mod, up to its tx_eob tag
+        tb = gr.top_block()
+        mod = lora.mod(sf, 0x12, 1, MOD_OUTPUT_BURST)
+        sink = blocks.vector_sink_c()
+        tb.connect(mod, sink)
+        mod.to_basic_block()._post(pmt.intern("in"),
+            pmt.cons(pmt.make_dict(), pmt.init_u16vector(len(symbols), symbols)))
+        eob = lambda: [t.offset for t in sink.tags() if pmt.symbol_to_string(t.key) == "tx_eob"]
+        self.run_until(tb, lambda: len(eob()) > 0)
+        self.assertEqual(len(eob()), 1)
+        return list(sink.data())[:eob()[0] + 1]
+
+    def test_001_loopback(self):
+        # an SF7 packet inside an SF9 one, implicit header, 6 byte payload, CR 4/8, no CRC: 16 symbols each
+        rng = random.Random(1)
+        sent = {}
+        for sf in (7, 9):
+            # the header block carries sf-2 bits per symbol
+            sent[sf] = [4*rng.randrange(1 << (sf-2)) for i in range(8)] + [rng.randrange(1 << sf) for i in range(8)]
+        iq7 = self.modulate(7, sent[7])
+        iq9 = self.modulate(9, sent[9])
+
+        start7, start9 = 4096, 4096 + 3000
+        x = [0j] * (start9 + len(iq9) + 8192)
+        for i, v in enumerate(iq7):
+            x[start7 + i] += v
+        for i, v in enumerate(iq9):
+            x[start9 + i] += v
+        # silence would put every FFT peak in bin 0, which looks like a preamble
+        x = [v + complex(rng.uniform(-0.05, 0.05), rng.uniform(-0.05, 0.05)) for v in x]
+
+        src = blocks.vector_source_c(x)
+        demod = lora.multi_sf_demod(7, 9, False, 6, 4, False, False, 4, 0, 4, 1)
+        store = blocks.message_debug()
+        self.tb.connect(src, demod)
+        self.tb.msg_connect((demod, "out"), (store, "store"))
+        self.run_until(self.tb, lambda: store.num_messages() >= 2)
+
+        self.assertEqual(store.num_messages(), 2)
+        received = {}
+        for i in range(store.num_messages()):
+            msg = store.get_message(i)
+            sf = pmt.to_long(pmt.dict_ref(pmt.car(msg), pmt.intern("sf"), pmt.PMT_NIL))
+            received[sf] = list(pmt.u16vector_elements(pmt.cdr(msg)))
+        self.assertEqual(sorted(received.keys()), [7, 9])
+        for sf in (7, 9):
+            self.assertEqual(len(received[sf]), len(sent[sf]))
+            # the SFD sync leaves a fractional symbol offset, so a symbol may round to a neighbouring bin
+            for r, s in zip(received[sf], sent[sf]):
+                self.assertIn((r - s) % (1 << sf), (0, 1, (1 << sf) - 1))
+
+
+if __name__ == '__main__':
+    gr_unittest.run(qa_multi_sf_demod)
@@ -14,6 +14,8 @@
 #include "lora/decode.h"
 #include "lora/encode.h"
 #include "lora/weak_demod.h"
+#include "lora/multi_sf_demod.h"
+#include "lora/channelizer.h"
 %}
 
 %include "lora/demod.h"
@@ -28,3 +30,7 @@ GR_SWIG_BLOCK_MAGIC2(lora, decode);
 GR_SWIG_BLOCK_MAGIC2(lora, encode);
 %include "lora/weak_demod.h"
 GR_SWIG_BLOCK_MAGIC2(lora, weak_demod);
+%include "lora/multi_sf_demod.h"
+GR_SWIG_BLOCK_MAGIC2(lora, multi_sf_demod);
+%include "lora/channelizer.h"
+GR_SWIG_BLOCK_MAGIC2(lora, channelizer);